@@ -28,16 +28,27 @@ build() {
 	find_CMSIS
 
 	SOURCE_FILES="./src/main.c
+		./src/registry.c
+		./src/codec.c
+		./src/predictor.c
+		./src/rtc_timer.c
+		./src/sched.c
+		./src/log.c
 		./SEGGER_RTT/RTT/SEGGER_RTT.c
 		./SEGGER_RTT/RTT/SEGGER_RTT_printf.c
 		$NRFX/mdk/gcc_startup_nrf51.S
 		$NRFX/mdk/system_nrf51.c"
 	INCLUDE="-I./src -I$NRFX/mdk -I$CMSIS -I./SEGGER_RTT/RTT"
 	LIBS="-L./src -L$NRFX/mdk"
+	if [ "$BUILD_MODE" == "BUILD_MODE_HOST" ]; then
+		MEMORY_FLAGS="-D__STACK_SIZE=8192 -Tnrf51_xxac.ld"
+	else
+		MEMORY_FLAGS="-D__STACK_SIZE=4096 -Tnrf51_xxac-8kRAM.ld"
+	fi
 	CFLAGS="-Os -g3 -fdata-sections -ffunction-sections -Wl,--gc-sections
 		-Wall -fno-strict-aliasing -fshort-enums
-		-D__HEAP_SIZE=128 -D__STACK_SIZE=4096 -D$BUILD_MODE
-		-mthumb -mabi=aapcs -Tnrf51_xxac-8kRAM.ld
+		-D__HEAP_SIZE=128 $MEMORY_FLAGS -D$BUILD_MODE ${LOG_LEVEL:+-DLOG_LEVEL=$LOG_LEVEL} ${LOG_DEFERRED:+-DLOG_DEFERRED=$LOG_DEFERRED} $EXTRA_CFLAGS
+		-mthumb -mabi=aapcs
 		-mcpu=cortex-m0 -Wno-unused
 		-DNRF51422_XXAC"
 
@@ -45,6 +56,10 @@ build() {
 	$CC $CFLAGS $INCLUDE $LIBS $SOURCE_FILES -Wl,-Map=${TARGET}.map -o ${TARGET}.elf
 	$OBJDUMP -d ${TARGET}.elf > ${TARGET}.lst
 	$OBJCOPY -O ihex ${TARGET}.elf ${TARGET}.hex
+	if [ "$LOG_DEFERRED" == "1" ]; then
+		$OBJCOPY --dump-section .logstr=${TARGET}.logstr ${TARGET}.elf
+		$OBJCOPY -O binary ${TARGET}.elf ${TARGET}.bin
+	fi
 	echo "Success"
 }
 
@@ -53,6 +68,8 @@ clean() {
 	rm -f ${TARGET}.lst
 	rm -f ${TARGET}.hex
 	rm -f ${TARGET}.map
+	rm -f ${TARGET}.logstr
+	rm -f ${TARGET}.bin
 }
 
 flash() {
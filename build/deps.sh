@@ -18,6 +18,7 @@ find_CC() {
 			CC=$1$2
 			OBJCOPY=${1}objcopy
 			OBJDUMP=${1}objdump
+			SIZE=${1}size
 			return 1
 		else
 			return 0
@@ -120,10 +121,12 @@ if [ "$1" == "_do_actual_job" ]; then
 	echo CC:=$CC >> obj/deps.mk
 	echo OBJCOPY:=$OBJCOPY >> obj/deps.mk
 	echo OBJDUMP:=$OBJDUMP >> obj/deps.mk
+	echo SIZE:=$SIZE >> obj/deps.mk
 	echo CMSIS:=$CMSIS >> obj/deps.mk
 	echo NRFX:=$NRFX >> obj/deps.mk
 	echo NRFJPROG:=$NRFJPROG >> obj/deps.mk
 else
+	mkdir -p obj
 	./deps.sh _do_actual_job > obj/deps-results.txt 2>&1
 	if [ $? -ne 0 ]; then
 		echo '$(info $(file < obj/deps-results.txt))' > obj/deps.mk
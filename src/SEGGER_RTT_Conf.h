@@ -72,10 +72,11 @@ Revision: $Rev: 24316 $
 //
 // Most common case:
 // Up-channel 0: RTT
-// Up-channel 1: SystemView
+// Up-channel 1: Records (host)
+// Up-channel 2: Deferred log (LOG_DEFERRED=1)
 //
 #ifndef   SEGGER_RTT_MAX_NUM_UP_BUFFERS
-  #define SEGGER_RTT_MAX_NUM_UP_BUFFERS             (2)     // Max. number of up-buffers (T->H) available on this target    (Default: 3)
+  #define SEGGER_RTT_MAX_NUM_UP_BUFFERS             (3)     // Max. number of up-buffers (T->H) available on this target    (Default: 3)
 #endif
 //
 // Most common case:
@@ -87,11 +88,15 @@ Revision: $Rev: 24316 $
 #endif
 
 #ifndef   BUFFER_SIZE_UP
-  #define BUFFER_SIZE_UP                            (512)  // Size of the buffer for terminal output of target, up to host (Default: 1k)
+  #if LOG_DEFERRED                                         // Log goes to up-channel 2, see log.c
+    #define BUFFER_SIZE_UP                          (64)
+  #else
+    #define BUFFER_SIZE_UP                          (512)  // Size of the buffer for terminal output of target, up to host (Default: 1k)
+  #endif
 #endif
 
 #ifndef   BUFFER_SIZE_DOWN
-  #define BUFFER_SIZE_DOWN                          (16)    // Size of the buffer for terminal input to target from host (Usually keyboard input) (Default: 16)
+  #define BUFFER_SIZE_DOWN                          (64)    // Size of the buffer for terminal input to target from host (Usually keyboard input) (Default: 16)
 #endif
 
 #ifndef   SEGGER_RTT_PRINTF_BUFFER_SIZE
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef ACK_TIMEOUT_H
+#define ACK_TIMEOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Length of the dongle's ACK listen window, also used by tools/rx_timeout_sim.
+//
+// Jacobson/Karels estimator: smoothed ACK time plus four smoothed mean deviations,
+// so a single late ACK widens the window only a little and for a few reports.
+// Units are the caller's, the window is never shorter than "floor", which is the
+// earliest time the ACK can be received. Missed ACKs do not update the estimate
+// (their time is unknown). Most of them are lost packets, that a longer window would
+// not catch, so the window doubles only from the second consecutive miss on. This still
+// finds a host that answers later than the estimate, even across reports.
+
+#define ACK_TIMEOUT_BACKOFF_MAX 3 // Window stops doubling at 8 times the estimate
+// Minimum deviation term of windows in us. A late ACK costs a retry: a TX and about 300 ms
+// of backoff with the crystal running, the charge of about 10 ms of RX. Four mean deviations
+// underestimate long-tailed turnaround jitter, see tools/rx_timeout_sim.
+#define ACK_TIMEOUT_DEVIATION_MIN_US 600
+
+typedef struct {
+	int32_t srtt;    // Smoothed ACK time, scaled by 8
+	int32_t rttvar;  // Smoothed mean deviation, scaled by 4
+	uint8_t misses;  // Consecutive missed ACKs
+	bool valid;
+} AckTimeout;
+
+static inline void ack_timeout_reset(AckTimeout *estimator) {
+	estimator->srtt = 0;
+	estimator->rttvar = 0;
+	estimator->misses = 0;
+	estimator->valid = false;
+}
+
+// Adds time from the start of listening to the received ACK
+static inline void ack_timeout_sample(AckTimeout *estimator, uint32_t time) {
+	int32_t measured = time;
+	estimator->misses = 0;
+	if (!estimator->valid) {
+		estimator->srtt = measured << 3;
+		estimator->rttvar = measured << 1;
+		estimator->valid = true;
+		return;
+	}
+	int32_t delta = measured - (estimator->srtt >> 3);
+	estimator->srtt += delta;
+	if (delta < 0) {
+		delta = -delta;
+	}
+	estimator->rttvar += delta - (estimator->rttvar >> 2);
+}
+
+// Called when the window expired without a valid ACK
+static inline void ack_timeout_miss(AckTimeout *estimator) {
+	if (estimator->misses <= ACK_TIMEOUT_BACKOFF_MAX) {
+		estimator->misses++;
+	}
+}
+
+// Deviation term is at least "deviation_min": the quantization of the measured times,
+// or the turnaround jitter that a few samples underestimate
+static inline uint32_t ack_timeout_window(const AckTimeout *estimator, uint32_t floor, uint32_t deviation_min,
+	uint32_t max)
+{
+	if (!estimator->valid) {
+		return max;
+	}
+	uint32_t window = (estimator->srtt >> 3) +
+		((uint32_t)estimator->rttvar > deviation_min ? (uint32_t)estimator->rttvar : deviation_min);
+	if (window < floor) {
+		window = floor;
+	}
+	if (estimator->misses > 1) {
+		window <<= estimator->misses - 1;
+	}
+	return window < max ? window : max;
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+// Retry scheduling of the dongle, also used by tools/backoff_sim.
+//
+// Retries are delayed by a random time from a window that doubles after each
+// failed attempt (binary exponential backoff), up to a cap. Dongles that
+// collided pick independent delays from the hardware RNG, so they are
+// unlikely to collide again.
+
+#define BACKOFF_MIN_MS 50
+#define BACKOFF_SLOT_MS 512      // Window after the first failure, power of two
+#define BACKOFF_EXP_MAX 3        // Window stops doubling at BACKOFF_SLOT_MS << BACKOFF_EXP_MAX
+
+// Each report deadline is delayed by a random jitter of up to this many
+// RTC ticks (~15.6 ms), power of two. Only until the host assigns a TDMA slot:
+// slots are narrower than this at intervals below about 6.4 s.
+#define REPORT_JITTER_TICKS 128
+
+// Delay in ms before the next attempt after "failed_count" (1, 2, ...) failed attempts.
+// "random" must be uniformly distributed, only its low bits are used.
+static inline uint32_t backoff_delay_ms(int failed_count, uint32_t random) {
+	int exponent = failed_count - 1 < BACKOFF_EXP_MAX ? failed_count - 1 : BACKOFF_EXP_MAX;
+	uint32_t window = (uint32_t)BACKOFF_SLOT_MS << exponent;
+	return BACKOFF_MIN_MS + (random & (window - 1));
+}
+
+#endif
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "codec.h"
+
+// Cortex-M0 has no divide instruction. Exact division by CODEC_TEMP_STEP is
+// a multiplication by its inverse modulo 2^32.
+#define CODEC_TEMP_STEP_INVERSE 0xC28F5C29u
+_Static_assert((uint32_t)(CODEC_TEMP_STEP * CODEC_TEMP_STEP_INVERSE) == 1, "Wrong CODEC_TEMP_STEP_INVERSE");
+
+typedef struct {
+	uint8_t *data;
+	int size;
+	int nibbles;
+} NibbleWriter;
+
+typedef struct {
+	const uint8_t *data;
+	int size;
+	int nibbles;
+} NibbleReader;
+
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static bool put_varint(NibbleWriter *w, uint32_t value) {
+	do {
+		uint8_t nibble = value & 7;
+		value >>= 3;
+		if (value) {
+			nibble |= 8;
+		}
+		int byte = w->nibbles >> 1;
+		if (byte >= w->size) {
+			return false;
+		}
+		if (w->nibbles & 1) {
+			w->data[byte] |= nibble << 4;
+		} else {
+			w->data[byte] = nibble;
+		}
+		w->nibbles++;
+	} while (value);
+	return true;
+}
+
+static bool get_varint(NibbleReader *r, uint32_t *value) {
+	*value = 0;
+	for (int shift = 0; shift < 32; shift += 3) {
+		int byte = r->nibbles >> 1;
+		if (byte >= r->size) {
+			return false;
+		}
+		uint8_t nibble = (r->nibbles & 1) ? r->data[byte] >> 4 : r->data[byte] & 15;
+		r->nibbles++;
+		*value |= (uint32_t)(nibble & 7) << shift;
+		if (!(nibble & 8)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Values beyond what the encoder produces are rejected, so the sums cannot overflow
+static bool get_signed(NibbleReader *r, int32_t *result) {
+	uint32_t value;
+	if (!get_varint(r, &value)) {
+		return false;
+	}
+	*result = unzigzag(value);
+	return *result >= -0xFFFF && *result <= 0xFFFF;
+}
+
+static bool fits_int16(int32_t value) {
+	return value >= INT16_MIN && value <= INT16_MAX;
+}
+
+int codec_encode(const BatchSample *samples, int count, uint8_t *out, int size) {
+	NibbleWriter w = { out, size, 0 };
+	if (count <= 0 ||
+		!put_varint(&w, count) ||
+		!put_varint(&w, zigzag(samples[0].temp)) ||
+		!put_varint(&w, zigzag(samples[0].voltage)))
+	{
+		return -1;
+	}
+	for (int i = 1; i < count; i++) {
+		int32_t temp_delta = samples[i].temp - samples[i - 1].temp;
+		int32_t voltage_delta = samples[i].voltage - samples[i - 1].voltage;
+		int32_t steps = (int32_t)((uint32_t)temp_delta * CODEC_TEMP_STEP_INVERSE);
+		if (steps > 0xFFFF || steps < -0xFFFF || steps * CODEC_TEMP_STEP != temp_delta) {
+			return -1;
+		}
+		if (!put_varint(&w, (zigzag(steps) << 1) | (voltage_delta != 0))) {
+			return -1;
+		}
+		if (voltage_delta != 0 && !put_varint(&w, zigzag(voltage_delta))) {
+			return -1;
+		}
+	}
+	return (w.nibbles + 1) >> 1;
+}
+
+int codec_decode(const uint8_t *data, int size, BatchSample *samples, int max) {
+	NibbleReader r = { data, size, 0 };
+	uint32_t count;
+	int32_t temp;
+	int32_t voltage;
+	if (!get_varint(&r, &count) || count == 0 || count > (uint32_t)max ||
+		!get_signed(&r, &temp) || !get_signed(&r, &voltage) ||
+		!fits_int16(temp) || !fits_int16(voltage))
+	{
+		return -1;
+	}
+	samples[0].temp = temp;
+	samples[0].voltage = voltage;
+	for (uint32_t i = 1; i < count; i++) {
+		uint32_t value;
+		if (!get_varint(&r, &value)) {
+			return -1;
+		}
+		int32_t steps = unzigzag(value >> 1);
+		if (steps < -0xFFFF || steps > 0xFFFF) {
+			return -1;
+		}
+		temp += steps * CODEC_TEMP_STEP;
+		if (value & 1) {
+			int32_t delta;
+			if (!get_signed(&r, &delta)) {
+				return -1;
+			}
+			voltage += delta;
+		}
+		if (!fits_int16(temp) || !fits_int16(voltage)) {
+			return -1;
+		}
+		samples[i].temp = temp;
+		samples[i].voltage = voltage;
+	}
+	return count;
+}
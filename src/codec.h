@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+// Compact encoding of a series of samples, used for UPLINK_BATCH_PACKED.
+//
+// Data is a stream of nibble varints (3 value bits per nibble, bit 3 set if
+// more nibbles follow, low nibble of a byte first) holding:
+//   number of samples,
+//   first sample: zig-zag temp, zig-zag voltage,
+//   each next sample: zig-zag(temp delta / CODEC_TEMP_STEP) << 1 | voltage changed,
+//                     zig-zag voltage delta if it changed.
+// Sample with no change takes one nibble.
+
+// NRF_TEMP resolution in 1/100 °C
+#define CODEC_TEMP_STEP 25
+
+// Encodes "count" samples into "out" of "size" bytes. Returns number of bytes
+// used or -1 if they do not fit or a temperature change is not a multiple of CODEC_TEMP_STEP.
+int codec_encode(const BatchSample *samples, int count, uint8_t *out, int size);
+
+// Decodes at most "max" samples. Returns number of samples or -1 if data is malformed
+// or decodes to values the encoder could not have produced.
+int codec_decode(const uint8_t *data, int size, BatchSample *samples, int max);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <stdint.h>
+#include "nrf.h"
+#include "SEGGER_RTT.h"
+#include "rtc_timer.h"
+#include "log.h"
+
+#if LOG_BENCH
+
+// Counts cycles with TIMER1 at 16 MHz, the CPU clock (Cortex-M0 has no cycle counter).
+// Levels above LOG_LEVEL are not compiled in and take 0 cycles. RTT buffers are
+// empty at start-up, so no call is dropped or blocked.
+#define LOG_BENCH_CALL(name, call) do { \
+		NRF_TIMER1->TASKS_CLEAR = 1; \
+		NRF_TIMER1->TASKS_START = 1; \
+		call; \
+		NRF_TIMER1->TASKS_CAPTURE[0] = 1; \
+		NRF_TIMER1->TASKS_STOP = 1; \
+		SEGGER_RTT_printf(0, "%s: %u cycles\n", name, NRF_TIMER1->CC[0] - overhead); \
+	} while (0)
+
+void log_bench() {
+	volatile uint32_t a = 1;
+	volatile uint32_t b = 22;
+	volatile uint32_t c = 333;
+	NRF_TIMER1->MODE = TIMER_MODE_MODE_Timer;
+	NRF_TIMER1->BITMODE = TIMER_BITMODE_BITMODE_16Bit;
+	NRF_TIMER1->PRESCALER = 0;
+	NRF_TIMER1->TASKS_CLEAR = 1;
+	NRF_TIMER1->TASKS_START = 1;
+	NRF_TIMER1->TASKS_CAPTURE[0] = 1;
+	NRF_TIMER1->TASKS_STOP = 1;
+	uint32_t overhead = NRF_TIMER1->CC[0];
+	SEGGER_RTT_printf(0, "Log cost at LOG_LEVEL %d%s:\n", LOG_LEVEL, LOG_DEFERRED ? ", deferred" : "");
+	LOG_BENCH_CALL("LOG_ERR, 3 args", LOG_ERR("Bench %d %d %d\n", a, b, c));
+	LOG_BENCH_CALL("LOG_WRN, 3 args", LOG_WRN("Bench %d %d %d\n", a, b, c));
+	LOG_BENCH_CALL("LOG_INF, 3 args", LOG_INF("Bench %d %d %d\n", a, b, c));
+	LOG_BENCH_CALL("LOG_DBG, 3 args", LOG_DBG("Bench %d %d %d\n", a, b, c));
+	LOG_BENCH_CALL("LOG_TRC, 3 args", LOG_TRC("Bench %d %d %d\n", a, b, c));
+	LOG_BENCH_CALL("LOG_INF, no args", LOG_INF("Bench\n"));
+}
+
+#endif
+
+#if LOG_DEFERRED
+
+#define LOG_BUFFER_SIZE 512
+
+static char log_buffer[LOG_BUFFER_SIZE];
+
+void log_init() {
+	SEGGER_RTT_ConfigUpBuffer(LOG_CHANNEL, "Log", log_buffer, sizeof(log_buffer), SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+}
+
+// Record is LogHeader and arguments, built by LOG_PRINT, size in bytes (at most 32).
+// Record is dropped whole when the buffer is full. Interrupts are blocked only for the
+// timestamp and the copy, so records of interrupts do not interleave and stay in time order.
+void log_write(uint32_t *record, uint32_t size) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	record[1] = (uint32_t)rtc_now();
+	SEGGER_RTT_WriteSkipNoLock(LOG_CHANNEL, record, size);
+	__set_PRIMASK(primask);
+}
+
+#endif
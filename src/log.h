@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include "SEGGER_RTT.h"
+#include "log_record.h"
+
+// Leveled log on RTT channel 0. LOG_LEVEL is set for each source file by the build
+// (LOG_LEVEL and LOG_LEVEL_<file> in build/Makefile). Messages above it are removed
+// by the preprocessor, with their format strings and the code computing their
+// arguments, so the arguments must not have side effects.
+//
+// With LOG_DEFERRED=1 messages are not formatted on the chip. Format strings go to
+// the .logstr section, which is not loaded to flash, and only their offset, a timestamp
+// and the raw arguments are written to RTT channel LOG_CHANNEL (log_record.h), to be
+// formatted by tools/log_decode. Arguments are sent as 32-bit integers: "%s" works only
+// for strings in flash and there is no floating point, as in SEGGER_RTT_printf.
+
+#define LOG_LEVEL_OFF 0
+#define LOG_LEVEL_ERR 1 // Device cannot do its job
+#define LOG_LEVEL_WRN 2 // Something was lost or degraded
+#define LOG_LEVEL_INF 3 // Configuration changes and one summary per report
+#define LOG_LEVEL_DBG 4 // Steps of a report
+#define LOG_LEVEL_TRC 5 // Details of each radio exchange
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INF
+#endif
+
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED 0
+#endif
+
+#ifndef LOG_BENCH
+#define LOG_BENCH 0
+#endif
+
+#define LOG_DISABLED(...) do { } while (0)
+
+#if LOG_BENCH
+// Prints CPU cycles of one call of each LOG_* macro on RTT channel 0, see log.c
+void log_bench();
+#endif
+
+#if LOG_DEFERRED
+
+void log_init();
+void log_write(uint32_t *record, uint32_t size);
+
+#define LOG_COUNT(...) LOG_COUNT_(0, ##__VA_ARGS__, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_COUNT_(_0, _1, _2, _3, _4, _5, _6, _7, count, ...) count
+#define LOG_ARG(arg) , (uint32_t)(uintptr_t)(arg)
+#define LOG_ARGS(...) LOG_ARGS_(LOG_COUNT(__VA_ARGS__), ##__VA_ARGS__)
+#define LOG_ARGS_(count, ...) LOG_ARGS__(count, ##__VA_ARGS__)
+#define LOG_ARGS__(count, ...) LOG_ARGS_##count(__VA_ARGS__)
+#define LOG_ARGS_0(...)
+#define LOG_ARGS_1(a) LOG_ARG(a)
+#define LOG_ARGS_2(a, ...) LOG_ARG(a) LOG_ARGS_1(__VA_ARGS__)
+#define LOG_ARGS_3(a, ...) LOG_ARG(a) LOG_ARGS_2(__VA_ARGS__)
+#define LOG_ARGS_4(a, ...) LOG_ARG(a) LOG_ARGS_3(__VA_ARGS__)
+#define LOG_ARGS_5(a, ...) LOG_ARG(a) LOG_ARGS_4(__VA_ARGS__)
+#define LOG_ARGS_6(a, ...) LOG_ARG(a) LOG_ARGS_5(__VA_ARGS__)
+
+// Record is built in place by the caller: first word of LogHeader is a link time constant,
+// timestamp is filled by log_write() and arguments are stored without va_list.
+#define LOG_PRINT(level, format, ...) do { \
+		static const char log_format[] __attribute__((section(".logstr"), aligned(1))) = format; \
+		_Static_assert(LOG_COUNT(__VA_ARGS__) <= LOG_ARGS_MAX, "Too many log arguments"); \
+		uint32_t log_record[] = { \
+			(uint32_t)(uintptr_t)log_format + ((LOG_SYNC | ((level) << 4 | LOG_COUNT(__VA_ARGS__)) << 8) << 16), \
+			0 LOG_ARGS(__VA_ARGS__) }; \
+		log_write(log_record, sizeof(log_record)); \
+	} while (0)
+
+#else
+
+static inline void log_init() { }
+
+#define LOG_PRINT(level, ...) SEGGER_RTT_printf(0, __VA_ARGS__)
+
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERR
+#	define LOG_ERR(...) LOG_PRINT(LOG_LEVEL_ERR, __VA_ARGS__)
+#else
+#	define LOG_ERR LOG_DISABLED
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WRN
+#	define LOG_WRN(...) LOG_PRINT(LOG_LEVEL_WRN, __VA_ARGS__)
+#else
+#	define LOG_WRN LOG_DISABLED
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INF
+#	define LOG_INF(...) LOG_PRINT(LOG_LEVEL_INF, __VA_ARGS__)
+#else
+#	define LOG_INF LOG_DISABLED
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DBG
+#	define LOG_DBG(...) LOG_PRINT(LOG_LEVEL_DBG, __VA_ARGS__)
+#else
+#	define LOG_DBG LOG_DISABLED
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_TRC
+#	define LOG_TRC(...) LOG_PRINT(LOG_LEVEL_TRC, __VA_ARGS__)
+#else
+#	define LOG_TRC LOG_DISABLED
+#endif
+
+#endif
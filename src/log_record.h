@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef LOG_RECORD_H
+#define LOG_RECORD_H
+
+#include <stdint.h>
+
+// Deferred log stream (LOG_DEFERRED=1) on RTT up-buffer LOG_CHANNEL.
+// Decoded on Linux by tools/log_decode.
+//
+// Each record is LogHeader and "args" raw 32-bit arguments. Format strings are not
+// sent: "format" is the offset of the string in the .logstr ELF section, that
+// the build extracts into the dictionary file. Records are written whole or not
+// at all. All values are little endian.
+
+#define LOG_CHANNEL 2
+#define LOG_SYNC 0x5A
+#define LOG_ARGS_MAX 6
+#define LOG_TICKS_PER_SECOND 8192
+
+// First word is the format address plus a constant, so the linker computes it
+typedef struct __attribute__((packed)) {
+	uint16_t format;     // Offset of the format string in .logstr
+	uint8_t sync;
+	uint8_t level_args;  // Level (LOG_LEVEL_*) in high 4 bits, number of arguments in low 4 bits
+	uint32_t timestamp;  // Uptime in LOG_TICKS_PER_SECOND (rtc_now()), low 32 bits
+} LogHeader;
+
+#endif
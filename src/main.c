@@ -7,65 +7,81 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include "nrf.h"
+#include "protocol.h"
+#include "codec.h"
+#include "predictor.h"
+#include "backoff.h"
+#include "ack_timeout.h"
+#include "ring.h"
+#include "registry.h"
+#include "records.h"
+#include "rtc_timer.h"
+#include "sched.h"
 
-#if 1
 #include "SEGGER_RTT.h"
-#else
-#define SEGGER_RTT_printf(...) do { } while (0)
+#include "log.h"
+
+// Set to 0 to start the crystal only when the radio needs it, for comparing awake times
+#ifndef HFCLK_EARLY_START
+#define HFCLK_EARLY_START 1
 #endif
 
+static volatile bool hfclk_started = false;
+static volatile uint64_t hfclk_started_time;
+
+// Interrupts only acknowledge the events, the work is done by the tasks
 void POWER_CLOCK_IRQHandler() {
-	NRF_CLOCK->INTENCLR = 0xFFFFFFFF;
+	if (NRF_CLOCK->EVENTS_HFCLKSTARTED) {
+		NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
+		hfclk_started_time = rtc_now();
+		hfclk_started = true;
+		sched_post(EVENT_HFCLK);
+	}
+	if (NRF_CLOCK->EVENTS_LFCLKSTARTED) {
+		NRF_CLOCK->EVENTS_LFCLKSTARTED = 0;
+		sched_post(EVENT_LFCLK);
+	}
 }
 
 void TEMP_IRQHandler() {
-	NRF_TEMP->INTENCLR = 0xFFFFFFFF;
+	if (NRF_TEMP->EVENTS_DATARDY) {
+		NRF_TEMP->EVENTS_DATARDY = 0;
+		sched_post(EVENT_TEMP);
+	}
 }
 
-void RTC0_IRQHandler() {
-	NRF_RTC0->INTENCLR = 0xFFFFFFFF;
-}
+#if defined(BUILD_MODE_HOST)
+static void host_radio_irq();
+// Main loop wakes up periodically to read commands from RTT
+static const uint32_t COMMAND_POLL_TICKS = 100 * 1024 / 125;
+#endif
 
 void ADC_IRQHandler() {
-	NRF_ADC->INTENCLR = 0xFFFFFFFF;
+	if (NRF_ADC->EVENTS_END) {
+		NRF_ADC->EVENTS_END = 0;
+		sched_post(EVENT_ADC);
+	}
 }
 
 void RADIO_IRQHandler() {
-	NRF_RADIO->INTENCLR = 0xFFFFFFFF;
-}
-
-
-static void delay(int t) {
-	NRF_RTC0->TASKS_CLEAR = 1;
-	NRF_RTC0->CC[0] = t;
-	NRF_RTC0->INTENSET = RTC_INTENSET_COMPARE0_Msk;
-	NRF_RTC0->TASKS_START = 1;
-	while (!NRF_RTC0->EVENTS_COMPARE[0]) __WFE();
-	NRF_RTC0->EVENTS_COMPARE[0] = 0;
-	NRF_RTC0->TASKS_STOP = 1;
-}
-
-static void delay_ms(int ms) {
-	delay(ms * 1024 / 125);
+#	if defined(BUILD_MODE_HOST)
+	host_radio_irq();
+#	else
+	if (NRF_RADIO->EVENTS_BCMATCH) {
+		NRF_RADIO->EVENTS_BCMATCH = 0;
+		sched_post(EVENT_BCMATCH);
+	}
+	if (NRF_RADIO->EVENTS_DISABLED) {
+		NRF_RADIO->EVENTS_DISABLED = 0;
+		sched_post(EVENT_RADIO);
+	}
+#	endif
 }
 
 __attribute__((aligned(4)))
-static uint8_t packet[256];
-
-typedef struct {
-	uint32_t address_low;
-	uint16_t address_high;
-	int16_t temp;
-	int16_t voltage;
-} OutputPacket;
-
-typedef struct {
-	uint32_t address_low;
-	uint16_t address_high;
-	uint16_t _reserved;
-	uint16_t flags;
-} InputPacket;
+static uint8_t packet[FRAME_MAX_LENGTH + 1];
 
 static OutputPacket *const output_packet = (OutputPacket*)&packet[0];
 static InputPacket *const input_packet = (InputPacket*)&packet[0];
@@ -76,14 +92,30 @@ static const uint32_t FREQUENCY = 2400;
 static const uint32_t BASE_ADDR = 0x63e0;
 static const uint32_t PREFIX_BYTE_ADDR = 0x17;
 static const uint32_t CRC_POLY = 0x864CFB; // CRC-24-Radix-64 (OpenPGP)
-static const uint32_t RETRY_DELAY_MS = 1000;
-static const uint16_t INPUT_FLAG_ACK = 0x8000;
+// Time from host's DISABLED event (end of received packet) to ACK TXEN.
+// Gives the remote some margin to switch to RX. Whole turnaround is ACK_DELAY_US + TX ramp-up.
+static const uint32_t ACK_DELAY_US = 40;
+static const uint32_t RADIO_RAMP_UP_US = 140; // TXEN or RXEN to READY
+// ADDRESS event comes after the preamble and the address, 32 us per byte at 250 kbit
+static const uint32_t ACK_ADDRESS_TIME_US = (1 + 3) * 32;
+// Dongle is in RX this much before the ACK preamble, and the shortest ACK window
+// is this much after the earliest possible ACK address
+static const uint32_t RX_MARGIN_US = 16;
+// BCMATCH comes when the length and the address fields of an ACK are in, counted after the radio address
+// Shortest TDMA slot: the longest report and its ACK with ramp-ups and the turnaround,
+// 32 us per byte of preamble, address, frame and CRC, plus 2 ticks for rounding and drift
+static const uint32_t SLOT_MIN_US = 2 * RADIO_RAMP_UP_US + ACK_DELAY_US +
+	(1 + 3 + sizeof(OutputPacket) + 3) * 32 + (1 + 3 + sizeof(InputPacket) + 3) * 32;
+static const uint32_t SLOT_MIN_TICKS = SLOT_MIN_US * 1024 / 125000 + 2;
+static const uint32_t ACK_ADDRESS_FIELDS_BITS = (offsetof(InputPacket, address_low) + sizeof(uint32_t)) * 8;
 
 static const int FAILED_COUNT_ACCEPTABLE = 2;
 static const int FAILED_COUNT_INCREASE_POWER = 3;
 static const int FAILED_COUNT_FULL_POWER = 4;
 static const int FAILED_COUNT_GIVE_UP = 5;
 static const int ACCEPTABLE_COUNT_TO_POWER_DECREASE = 100;
+// Wanted RSSI at the host: 250kbit sensitivity is -96 dBm, so this gives 16 dB of margin for fading.
+static const int RSSI_TARGET_DBM = -80;
 
 
 static const uint8_t power_levels[] = {
@@ -97,21 +129,90 @@ static const uint8_t power_levels[] = {
 	RADIO_TXPOWER_TXPOWER_Pos4dBm,
 };
 
-static const char *const power_levels_str[] = {
-	"-30 dBm",
-	"-20 dBm",
-	"-16 dBm",
-	"-12 dBm",
-	"-8 dBm",
-	"-4 dBm",
-	"0 dBm",
-	"+4 dBm",
+static const int8_t power_levels_dbm[] = {
+	-30,
+	-20,
+	-16,
+	-12,
+	-8,
+	-4,
+	0,
+	4,
 };
 
 static const int POWER_LEVEL_MAX = sizeof(power_levels) / sizeof(power_levels[0]) - 1;
 static int power_level = 0;
-static const int RX_TIMEOUT_MAX = 10 * 1024/125;
-static int rx_timeout = RX_TIMEOUT_MAX;
+static int power_level_min = 0; // Limits set by the host
+static int power_level_max = POWER_LEVEL_MAX;
+static const int RX_TIMEOUT_MAX = 10000;
+static int rx_timeout = RX_TIMEOUT_MAX; // ACK address must come within this many us after our packet
+static AckTimeout ack_timeout;
+static int ack_rssi = 0; // -dBm of the last ACK received
+static int host_rssi = 0; // -dBm of our last packet as reported by the host in the ACK
+static int slot_correction = 0; // Shift of the next report requested by the host
+static bool slot_assigned = false; // Host keeps us in a TDMA slot, reports are not jittered
+static uint32_t report_jitter = 0; // Delay of the current report from its deadline
+static uint32_t report_interval_ms = REPORT_INTERVAL_MS;
+static uint8_t downlink_id = 0; // Id of the last applied downlink, 0 - none
+static bool diag_requested = false;
+static uint16_t report_count = 0;
+static uint16_t report_failed_count = 0;
+// Samples waiting for transmission, sent when there are batch_size of them
+#define SAMPLE_QUEUE_SIZE BATCH_MAX
+static BatchSample sample_queue[SAMPLE_QUEUE_SIZE];
+static Ring sample_ring;
+static int batch_size = 1;
+static DeadbandConfig deadband = { 0 };
+static BatchSample acked_sample; // Newest sample of the last acknowledged report
+static bool acked_sample_valid = false;
+static uint32_t time_since_report_ms = 0;
+static bool prediction_mode = false; // Deadband is around the predicted value instead of the last acked sample
+static Predictor predictor; // Fed with acknowledged samples, same as on the host
+static bool predictor_reset_pending = true;
+static uint16_t ack_flags = 0; // INPUT_FLAG_* of the last ACK
+static bool deadband_left = false; // A sample of the last checked batch was outside the deadband
+static uint16_t gap_samples = 0; // Samples discarded since the last acknowledged report
+static bool diag_sent = false;
+static bool exchange_acked = false; // Result of exchange_task()
+static RtcTimer retry_timer;
+static RtcTimer report_timer;
+// Measurement is started by the RTC through PPI, the CPU wakes up when it is done
+static const int RTC_CHANNEL_MEASURE = 1;
+static const int PPI_CH_MEASURE_TEMP = 0; // RTC0 COMPARE[1] -> TEMP START
+static const int PPI_CH_MEASURE_ADC = 1;  // RTC0 COMPARE[1] -> ADC START
+// Crystal is started by the RTC through PPI, so it is ready when the packet is
+static const int RTC_CHANNEL_HFCLK = 2;
+static const int PPI_CH_HFCLK_START = 2;  // RTC0 COMPARE[2] -> CLOCK HFCLKSTART
+static const uint32_t HFCLK_RAMP_INITIAL_TICKS = 16; // ~2 ms, until it is measured
+static const uint32_t HFCLK_MARGIN_TICKS = 1;
+static uint32_t hfclk_ramp = HFCLK_RAMP_INITIAL_TICKS * 8; // Average crystal start-up in 1/8 ticks
+static uint64_t hfclk_start_time;
+// ACK listen window is timed by TIMER0 from the DISABLED event of our packet, see rx_window_setup()
+static const int PPI_CH_RX_START = 3;   // RADIO DISABLED -> TIMER0 START
+static const int PPI_CH_RX_ARM = 4;     // RADIO DISABLED -> enable PPI_GROUP_RX_TIMEOUT
+static const int PPI_CH_RX_RXEN = 5;    // TIMER0 COMPARE[0] -> RADIO RXEN
+static const int PPI_CH_RX_ONCE = 6;    // TIMER0 COMPARE[0] -> disable PPI_GROUP_RX_START
+static const int PPI_CH_RX_TIMEOUT = 7; // TIMER0 COMPARE[1] -> RADIO DISABLE
+static const int PPI_CH_RX_GUARD = 8;   // RADIO ADDRESS -> disable PPI_GROUP_RX_TIMEOUT
+static const int PPI_CH_RX_CAPTURE = 9; // RADIO ADDRESS -> TIMER0 CAPTURE[2]
+static const int PPI_GROUP_RX_START = 0;
+static const int PPI_GROUP_RX_TIMEOUT = 1;
+
+// Hardware RNG with bias correction, 1 to 4 random bytes. Works without the crystal.
+// Busy waits, a byte takes only about 100 us.
+static uint32_t random_bits(int bytes) {
+	uint32_t value = 0;
+	NRF_RNG->CONFIG = RNG_CONFIG_DERCEN_Msk;
+	NRF_RNG->EVENTS_VALRDY = 0;
+	NRF_RNG->TASKS_START = 1;
+	for (int i = 0; i < bytes; i++) {
+		while (!NRF_RNG->EVENTS_VALRDY);
+		NRF_RNG->EVENTS_VALRDY = 0;
+		value = (value << 8) | NRF_RNG->VALUE;
+	}
+	NRF_RNG->TASKS_STOP = 1;
+	return value;
+}
 
 static void radio_start() {
 	NRF_RADIO->POWER = 1;
@@ -119,12 +220,12 @@ static void radio_start() {
 	NRF_RADIO->FREQUENCY = FREQUENCY - 2400;
 	NRF_RADIO->MODE = RADIO_MODE_MODE_Nrf_250Kbit;
 	NRF_RADIO->PCNF0 = 
-		(0 << RADIO_PCNF0_LFLEN_Pos) |
+		(8 << RADIO_PCNF0_LFLEN_Pos) |
 		(0 << RADIO_PCNF0_S0LEN_Pos) |
 		(0 << RADIO_PCNF0_S1LEN_Pos);
 	NRF_RADIO->PCNF1 = 
-		(10 << RADIO_PCNF1_MAXLEN_Pos) |
-		(10 << RADIO_PCNF1_STATLEN_Pos) |
+		(FRAME_MAX_LENGTH << RADIO_PCNF1_MAXLEN_Pos) |
+		(0 << RADIO_PCNF1_STATLEN_Pos) |
 		(2 << RADIO_PCNF1_BALEN_Pos) |
 		(RADIO_PCNF1_ENDIAN_Little << RADIO_PCNF1_ENDIAN_Pos);
 	NRF_RADIO->BASE0 = BASE_ADDR;
@@ -140,110 +241,446 @@ static void radio_stop()
 	NRF_RADIO->POWER = 0;
 }
 
-static bool exchange_packets(int16_t temp, int16_t voltage)
-{
-	// Setup output packet
-	output_packet->address_low = NRF_FICR->DEVICEADDR[0];
-	output_packet->address_high = NRF_FICR->DEVICEADDR[1];
-	output_packet->temp = temp;
-	output_packet->voltage = voltage;
-	__DMB();
+// Starts the crystals and the RTC
+static bool clock_start_task(Task *task) {
+	TASK_BEGIN(task);
+	LOG_DBG("Setting up the clock\n");
 
-	SEGGER_RTT_printf(0, "Sending packet %d/100\xB0""C, %dmV, %s...\n", temp, (int)voltage * 10, power_levels_str[power_level]);
+	sched_clear(EVENT_HFCLK | EVENT_LFCLK);
+	NRF_CLOCK->TASKS_HFCLKSTART = 1;
+	TASK_WAIT_EVENT(task, EVENT_HFCLK);
 
-	// Setup packet transmission
-	NRF_RADIO->TXPOWER = power_levels[power_level];
-	NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk | RADIO_SHORTS_DISABLED_RXEN_Msk;
-	NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
-	NRF_RADIO->TASKS_TXEN = 1;
-	while (!NRF_RADIO->EVENTS_DISABLED) __WFE();
-	NRF_RADIO->EVENTS_DISABLED = 0;
-	NRF_RADIO->EVENTS_END = 0;
+	NRF_CLOCK->LFCLKSRC = CLOCK_LFCLKSRC_SRC_Xtal;
+	NRF_CLOCK->TASKS_LFCLKSTART = 1;
+	TASK_WAIT_EVENT(task, EVENT_LFCLK);
 
-	SEGGER_RTT_printf(0, "Packet send. Receiving with timeout...\n");
+	rtc_timer_init();
 
-	// Setup packet receiving
-	NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk;
-	NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
+	LOG_DBG("DONE\n");
+	TASK_END(task);
+}
+
+// Applies commands received from the host in the ACK
+static void apply_downlink(const uint8_t *data, int size) {
+	for (int i = 0; tlv_valid(data, i, size); i += TLV_HEADER_SIZE + data[i + 1]) {
+		const uint8_t *value = &data[i + TLV_HEADER_SIZE];
+		int length = data[i + 1];
+		switch (data[i]) {
+		case DOWNLINK_SET_INTERVAL:
+			if (length >= 4) {
+				uint32_t interval = value[0] | (value[1] << 8) | (value[2] << 16) | ((uint32_t)value[3] << 24);
+				report_interval_ms = report_interval_clamp(interval);
+				LOG_INF("Report interval set to %dms\n", report_interval_ms);
+			}
+			break;
+		case DOWNLINK_SET_POWER:
+			if (length >= 2 && value[0] <= value[1] && value[1] <= POWER_LEVEL_MAX) {
+				power_level_min = value[0];
+				power_level_max = value[1];
+				if (power_level < power_level_min) {
+					power_level = power_level_min;
+				} else if (power_level > power_level_max) {
+					power_level = power_level_max;
+				}
+				LOG_INF("Power limits set to %d dBm ... %d dBm\n",
+					power_levels_dbm[power_level_min], power_levels_dbm[power_level_max]);
+			}
+			break;
+		case DOWNLINK_REQUEST_DIAG:
+			diag_requested = true;
+			break;
+		case DOWNLINK_SET_BATCH:
+			if (length >= 1 && value[0] >= 1 && value[0] <= BATCH_MAX) {
+				batch_size = value[0];
+				LOG_INF("Batch size set to %d\n", batch_size);
+			}
+			break;
+		case DOWNLINK_SET_DEADBAND:
+		case DOWNLINK_SET_PREDICTION:
+			if (length >= sizeof(DeadbandConfig)) {
+				memcpy(&deadband, value, sizeof(DeadbandConfig));
+				prediction_mode = data[i] == DOWNLINK_SET_PREDICTION;
+				LOG_INF("Deadband%s set to %d/100\xB0""C, %dmV, heartbeat %dms\n",
+					prediction_mode ? " around prediction" : "", deadband.temp, deadband.voltage * 10, deadband.heartbeat);
+			}
+			break;
+		default:
+			LOG_WRN("Unknown downlink command %d\n", data[i]);
+			break;
+		}
+	}
+}
 
-	// Set timeout
-	NRF_RTC0->TASKS_CLEAR = 1;
-	NRF_RTC0->CC[0] = rx_timeout;
-	NRF_RTC0->INTENSET = RTC_INTENSET_COMPARE0_Msk;
-	NRF_RTC0->TASKS_START = 1;
+// Shortest ACK window in us: earliest possible ACK address after our DISABLED, plus a margin
+static int ack_floor() {
+	return ACK_DELAY_US + RADIO_RAMP_UP_US + ACK_ADDRESS_TIME_US + RX_MARGIN_US;
+}
 
-	// Wait for end of packet receive or timeout
-	while (!NRF_RTC0->EVENTS_COMPARE[0] && !NRF_RADIO->EVENTS_DISABLED) __WFE();
+// Largest batch item, unpacked, and a gap after it must fit in any report
+#define BATCH_TLV_MAX (TLV_HEADER_SIZE + sizeof(BatchHeader) + (BATCH_MAX - 1) * sizeof(BatchSample))
+_Static_assert(BATCH_TLV_MAX + TLV_HEADER_SIZE + sizeof(GapData) <= OUTPUT_DATA_MAX, "Batch and gap do not fit");
 
-	// Stop timer
-	NRF_RTC0->TASKS_STOP = 1;
-	NRF_RTC0->EVENTS_COMPARE[0] = 0;
-	NRF_RTC0->INTENCLR = RTC_INTENCLR_COMPARE0_Msk;
+// Puts all queued samples into output_packet: the newest one in the header, older ones in UPLINK_BATCH
+static void exchange_prepare(uint8_t seq, int attempt)
+{
+	int count = ring_count(&sample_ring);
+	const BatchSample *newest = &sample_queue[(sample_ring.head - 1) & (SAMPLE_QUEUE_SIZE - 1)];
 
-	// Handle timeout
-	if (!NRF_RADIO->EVENTS_DISABLED) {
-		SEGGER_RTT_printf(0, "Timeout occured. Disabling radio...\n");
-		// Disable radio
-		NRF_RADIO->TASKS_DISABLE = 1;
-		while (!NRF_RADIO->EVENTS_DISABLED) __WFE();
+	// Setup output packet
+	output_packet->address_low = NRF_FICR->DEVICEADDR[0];
+	output_packet->address_high = NRF_FICR->DEVICEADDR[1];
+	output_packet->interval = report_interval_ms;
+	output_packet->temp = newest->temp;
+	output_packet->voltage = newest->voltage;
+	output_packet->seq = seq;
+	output_packet->flags = attempt < OUTPUT_FLAG_ATTEMPT_Msk ? attempt : OUTPUT_FLAG_ATTEMPT_Msk;
+	if (predictor_reset_pending) {
+		output_packet->flags |= OUTPUT_FLAG_RESET;
 	}
-	NRF_RADIO->EVENTS_DISABLED = 0;
-
-	if (!NRF_RADIO->EVENTS_END) {
-		SEGGER_RTT_printf(0, "No packet\n");
-		rx_timeout += rx_timeout / 2;
-		if (rx_timeout > RX_TIMEOUT_MAX) {
-			rx_timeout = RX_TIMEOUT_MAX;
+	output_packet->downlink_id = downlink_id;
+	rx_timeout = ack_timeout_window(&ack_timeout, ack_floor(), ACK_TIMEOUT_DEVIATION_MIN_US, RX_TIMEOUT_MAX);
+	int data_length = 0;
+	int offset;
+	// Batch goes first, it always fits (see BATCH_TLV_MAX). Other items are added only
+	// if there is space left: a gap is needed by the host's predictor, diag is retried.
+	if (count > 1) {
+		BatchSample samples[BATCH_MAX - 1];
+		uint8_t batch[sizeof(BatchHeader) + sizeof(samples)];
+		BatchHeader header = { .interval = report_interval_ms };
+		for (int i = 0; i < count - 1; i++) {
+			samples[i] = sample_queue[(sample_ring.tail + i) & (SAMPLE_QUEUE_SIZE - 1)];
+		}
+		memcpy(batch, &header, sizeof(header));
+		int packed = codec_encode(samples, count - 1, &batch[sizeof(BatchHeader)], sizeof(samples));
+		if (packed >= 0) {
+			offset = tlv_put(output_packet->data, data_length, OUTPUT_DATA_MAX, UPLINK_BATCH_PACKED, batch,
+				sizeof(BatchHeader) + packed);
 		} else {
-			SEGGER_RTT_printf(0, "Increasing timeout to %dus\n", rx_timeout);
+			memcpy(&batch[sizeof(BatchHeader)], samples, (count - 1) * sizeof(BatchSample));
+			offset = tlv_put(output_packet->data, data_length, OUTPUT_DATA_MAX, UPLINK_BATCH, batch,
+				sizeof(BatchHeader) + (count - 1) * sizeof(BatchSample));
+		}
+		if (offset >= 0) {
+			data_length = offset;
 		}
-		return false;
 	}
-	NRF_RADIO->EVENTS_END = 0;
+	if (gap_samples > 0) {
+		GapData gap = { .samples = gap_samples, .type = prediction_mode ? GAP_PREDICTED : GAP_DEADBAND };
+		offset = tlv_put(output_packet->data, data_length, OUTPUT_DATA_MAX, UPLINK_GAP, &gap, sizeof(gap));
+		if (offset >= 0) {
+			data_length = offset;
+		} else {
+			LOG_WRN("No space for the gap\n");
+		}
+	}
+	diag_sent = false;
+	if (diag_requested) {
+		DiagData diag = {
+			.interval = report_interval_ms,
+			.reports = report_count,
+			.failed = report_failed_count,
+			.power_level = power_level,
+			.power_level_min = power_level_min,
+			.power_level_max = power_level_max,
+			.rx_timeout = rx_timeout,
+			.batch_size = batch_size,
+			.deadband_temp = deadband.temp,
+			.deadband_voltage = deadband.voltage,
+			.heartbeat = deadband.heartbeat,
+			.prediction = prediction_mode,
+		};
+		offset = tlv_put(output_packet->data, data_length, OUTPUT_DATA_MAX, UPLINK_DIAG, &diag, sizeof(diag));
+		if (offset >= 0) {
+			data_length = offset;
+			diag_sent = true;
+		}
+	}
+	output_packet->length = OUTPUT_HEADER_LENGTH + data_length;
+	__DMB();
 
-	int receive_time = NRF_RTC0->COUNTER;
+	LOG_DBG("Sending packet %d/100\xB0""C, %dmV, %d samples, %d dBm...\n", newest->temp, (int)newest->voltage * 10,
+		count, power_levels_dbm[power_level]);
+}
 
-	SEGGER_RTT_printf(0, "Packet received after %d (%dus)\n", receive_time, receive_time * 15625/128);
+static bool ack_addressed_to_us() {
+	return input_packet->address_low == NRF_FICR->DEVICEADDR[0] &&
+		input_packet->address_high == (uint16_t)NRF_FICR->DEVICEADDR[1];
+}
 
-	if (input_packet->address_low != NRF_FICR->DEVICEADDR[0] ||
-		input_packet->address_high != (uint16_t)NRF_FICR->DEVICEADDR[1] ||
+// Checks the received ACK and applies its contents
+static bool exchange_check_ack()
+{
+	// ADDRESS disarms the window, so a captured address means the radio stopped at the packet END
+	int receive_time = NRF_TIMER0->CC[2];
+	if (receive_time == 0) {
+		LOG_DBG("No packet\n");
+		ack_timeout_miss(&ack_timeout);
+		return false;
+	}
+	int rssi = NRF_RADIO->RSSISAMPLE;
+
+	LOG_TRC("Packet received after %dus, RSSI -%d dBm\n", receive_time, rssi);
+
+	if (input_packet->length < INPUT_HEADER_LENGTH ||
+		!ack_addressed_to_us() ||
 		!(input_packet->flags & INPUT_FLAG_ACK) ||
 		(NRF_RADIO->CRCSTATUS & RADIO_CRCSTATUS_CRCSTATUS_Msk) != RADIO_CRCSTATUS_CRCSTATUS_CRCOk ||
 		(NRF_RADIO->RXMATCH & RADIO_RXMATCH_RXMATCH_Msk) != 0)
 	{
-		SEGGER_RTT_printf(0, "Invalid packet\n");
+		LOG_DBG("Invalid packet\n");
 		return false;
 	}
-
-	int new_timeout = 1 + receive_time + (receive_time + 2) / 3;
-	if (new_timeout < 2) {
-		new_timeout = 2;
+	ack_timeout_sample(&ack_timeout, receive_time);
+	ack_rssi = rssi;
+	host_rssi = input_packet->rssi;
+	// Host measured the jittered arrival, the deadline is earlier by the jitter.
+	// Slot is within our interval, so a larger correction was not computed for it.
+	uint32_t half_period = report_interval_ms * 1024 / 125 / 2;
+	if ((input_packet->flags & INPUT_FLAG_SLOT) &&
+		input_packet->slot_correction >= -(int32_t)half_period && input_packet->slot_correction <= (int32_t)half_period)
+	{
+		slot_correction = input_packet->slot_correction + report_jitter;
+		slot_assigned = true;
+	}
+	ack_flags = input_packet->flags;
+	if (diag_sent) {
+		diag_requested = false;
 	}
-	if (new_timeout != rx_timeout) {
-		SEGGER_RTT_printf(0, "Timeout adjusted to %d (%dus)\n", new_timeout, new_timeout * 15625/128);
+	// Host repeats the downlink until our next report confirms its id
+	if ((input_packet->flags & INPUT_FLAG_DOWNLINK) && input_packet->downlink_id != downlink_id) {
+		LOG_INF("Downlink %d received\n", input_packet->downlink_id);
+		downlink_id = input_packet->downlink_id;
+		apply_downlink(input_packet->data, input_packet->length - INPUT_HEADER_LENGTH);
 	}
-	rx_timeout = new_timeout;
 
 	return true;
 }
 
 
-static void communicate(int16_t temp, int16_t voltage) {
+// ACK listen window without the CPU: DISABLED of our packet starts TIMER0, COMPARE[0] enables RX
+// just before the ACK can come and COMPARE[1] disables the radio, unless an ADDRESS came first.
+// The radio then stops at the END of the packet (short), ADDRESS time is captured into CC[2].
+static void rx_window_setup() {
+	NRF_TIMER0->MODE = TIMER_MODE_MODE_Timer;
+	NRF_TIMER0->BITMODE = TIMER_BITMODE_BITMODE_16Bit;
+	NRF_TIMER0->PRESCALER = 4;
+	NRF_TIMER0->SHORTS = TIMER_SHORTS_COMPARE1_STOP_Msk;
+	// Host's TX ramp-up and our RX ramp-up are the same
+	NRF_TIMER0->CC[0] = ACK_DELAY_US - RX_MARGIN_US;
+
+	NRF_PPI->CH[PPI_CH_RX_START].EEP = (uint32_t)&NRF_RADIO->EVENTS_DISABLED;
+	NRF_PPI->CH[PPI_CH_RX_START].TEP = (uint32_t)&NRF_TIMER0->TASKS_START;
+	NRF_PPI->CH[PPI_CH_RX_ARM].EEP = (uint32_t)&NRF_RADIO->EVENTS_DISABLED;
+	NRF_PPI->CH[PPI_CH_RX_ARM].TEP = (uint32_t)&NRF_PPI->TASKS_CHG[PPI_GROUP_RX_TIMEOUT].EN;
+	NRF_PPI->CH[PPI_CH_RX_RXEN].EEP = (uint32_t)&NRF_TIMER0->EVENTS_COMPARE[0];
+	NRF_PPI->CH[PPI_CH_RX_RXEN].TEP = (uint32_t)&NRF_RADIO->TASKS_RXEN;
+	NRF_PPI->CH[PPI_CH_RX_ONCE].EEP = (uint32_t)&NRF_TIMER0->EVENTS_COMPARE[0];
+	NRF_PPI->CH[PPI_CH_RX_ONCE].TEP = (uint32_t)&NRF_PPI->TASKS_CHG[PPI_GROUP_RX_START].DIS;
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT].EEP = (uint32_t)&NRF_TIMER0->EVENTS_COMPARE[1];
+	NRF_PPI->CH[PPI_CH_RX_TIMEOUT].TEP = (uint32_t)&NRF_RADIO->TASKS_DISABLE;
+	NRF_PPI->CH[PPI_CH_RX_GUARD].EEP = (uint32_t)&NRF_RADIO->EVENTS_ADDRESS;
+	NRF_PPI->CH[PPI_CH_RX_GUARD].TEP = (uint32_t)&NRF_PPI->TASKS_CHG[PPI_GROUP_RX_TIMEOUT].DIS;
+	NRF_PPI->CH[PPI_CH_RX_CAPTURE].EEP = (uint32_t)&NRF_RADIO->EVENTS_ADDRESS;
+	NRF_PPI->CH[PPI_CH_RX_CAPTURE].TEP = (uint32_t)&NRF_TIMER0->TASKS_CAPTURE[2];
+	NRF_PPI->CHG[PPI_GROUP_RX_START] = (1 << PPI_CH_RX_START) | (1 << PPI_CH_RX_ARM);
+	NRF_PPI->CHG[PPI_GROUP_RX_TIMEOUT] = 1 << PPI_CH_RX_TIMEOUT;
+}
+
+// Arms the window for the next packet sent. Timeout is enabled only at its DISABLED,
+// the ADDRESS of our own packet would disarm it.
+static void rx_window_start(uint32_t window_us) {
+	NRF_TIMER0->TASKS_CLEAR = 1;
+	NRF_TIMER0->CC[1] = window_us;
+	NRF_TIMER0->CC[2] = 0;
+	NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+	NRF_PPI->CHENCLR = 1 << PPI_CH_RX_TIMEOUT;
+	NRF_PPI->CHENSET = (1 << PPI_CH_RX_START) | (1 << PPI_CH_RX_ARM) | (1 << PPI_CH_RX_RXEN) |
+		(1 << PPI_CH_RX_ONCE) | (1 << PPI_CH_RX_GUARD) | (1 << PPI_CH_RX_CAPTURE);
+}
+
+// Listens again for the rest of the window, after a frame that was not our ACK.
+// Returns false if our ACK could not start in time any more.
+static bool rx_window_restart() {
+	NRF_TIMER0->TASKS_CAPTURE[3] = 1;
+	if (NRF_TIMER0->CC[3] + RADIO_RAMP_UP_US + ACK_ADDRESS_TIME_US >= NRF_TIMER0->CC[1]) {
+		return false;
+	}
+	NRF_TIMER0->CC[2] = 0;
+	NRF_PPI->CHENSET = 1 << PPI_CH_RX_TIMEOUT;
+	sched_clear(EVENT_BCMATCH);
+	NRF_RADIO->TASKS_RXEN = 1;
+	return true;
+}
+
+static void rx_window_stop() {
+	NRF_PPI->CHENCLR = (1 << PPI_CH_RX_START) | (1 << PPI_CH_RX_ARM) | (1 << PPI_CH_RX_RXEN) |
+		(1 << PPI_CH_RX_ONCE) | (1 << PPI_CH_RX_TIMEOUT) | (1 << PPI_CH_RX_GUARD) | (1 << PPI_CH_RX_CAPTURE);
+	NRF_TIMER0->TASKS_STOP = 1;
+	NRF_TIMER0->TASKS_CLEAR = 1;
+}
+
+// RX has ended when the radio is disabled after the window enabled it
+static bool rx_window_ended() {
+	return NRF_TIMER0->EVENTS_COMPARE[0] && NRF_RADIO->STATE == RADIO_STATE_STATE_Disabled;
+}
+
+// Sends output_packet and receives the ACK, result is in exchange_acked
+static bool exchange_task(Task *task)
+{
+	TASK_BEGIN(task);
+	exchange_acked = false;
+
+	// Same shorts for the packet and the ACK, RX is started and stopped by the window
+	NRF_RADIO->TXPOWER = power_levels[power_level];
+	NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk |
+		RADIO_SHORTS_ADDRESS_RSSISTART_Msk | RADIO_SHORTS_DISABLED_RSSISTOP_Msk;
+	NRF_RADIO->BCC = ACK_ADDRESS_FIELDS_BITS;
+	rx_window_start(rx_timeout);
+	sched_clear(EVENT_RADIO);
+	NRF_RADIO->TASKS_TXEN = 1;
+
+	// Address fields are checked only in received frames. If we are late for the first one,
+	// it is checked after its END.
+	TASK_WAIT_EVENT(task, EVENT_RADIO);
+	NRF_RADIO->SHORTS |= RADIO_SHORTS_ADDRESS_BCSTART_Msk;
+	sched_clear(EVENT_BCMATCH);
+
+	// Another dongle's ACK or a corrupted frame does not end the window
+	while (true) {
+		TASK_WAIT_UNTIL(task, rx_window_ended() || sched_take(EVENT_BCMATCH));
+		if (!rx_window_ended()) {
+			if (ack_addressed_to_us()) {
+				continue;
+			}
+			// Foreign ACK, no need to receive the rest of it
+			NRF_RADIO->TASKS_DISABLE = 1;
+			TASK_WAIT_UNTIL(task, rx_window_ended());
+		} else if (NRF_TIMER0->CC[2] == 0 ||
+			((NRF_RADIO->CRCSTATUS & RADIO_CRCSTATUS_CRCSTATUS_Msk) == RADIO_CRCSTATUS_CRCSTATUS_CRCOk &&
+				ack_addressed_to_us()))
+		{
+			// Window expired or our ACK has been received
+			break;
+		}
+		LOG_TRC("Foreign or corrupted frame after %dus\n", NRF_TIMER0->CC[2]);
+		if (!rx_window_restart()) {
+			NRF_TIMER0->CC[2] = 0;
+			break;
+		}
+	}
+	rx_window_stop();
+
+	LOG_TRC("Packet sent, ACK window %dus\n", rx_timeout);
+	exchange_acked = exchange_check_ack();
+	TASK_END(task);
+}
+
+
+// Lowest power level that gives RSSI_TARGET_DBM at the host, based on the path loss
+// seen by the host when we transmitted at "level".
+static int power_level_for_rssi(int level, int rssi) {
+	int path_loss = power_levels_dbm[level] + rssi;
+	for (int i = 0; i < POWER_LEVEL_MAX; i++) {
+		if (power_levels_dbm[i] - path_loss >= RSSI_TARGET_DBM) {
+			return i;
+		}
+	}
+	return POWER_LEVEL_MAX;
+}
+
+// In deadband mode, queued samples are worth sending only if one of them left the
+// deadband around the last acknowledged value, or the host has not heard from us for too long.
+static bool report_needed() {
+	deadband_left = false;
+	if (deadband.heartbeat == 0 || !acked_sample_valid || time_since_report_ms >= deadband.heartbeat) {
+		return true;
+	}
+	for (uint32_t i = sample_ring.tail; i != sample_ring.head; i++) {
+		const BatchSample *sample = &sample_queue[i & (SAMPLE_QUEUE_SIZE - 1)];
+		BatchSample reference = acked_sample;
+		if (prediction_mode && !predictor_predict(&predictor, gap_samples + 1 + (i - sample_ring.tail), &reference)) {
+			return true;
+		}
+		if (abs(sample->temp - reference.temp) > deadband.temp ||
+			abs(sample->voltage - reference.voltage) > deadband.voltage)
+		{
+			deadband_left = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void discard_samples() {
+	while (!ring_empty(&sample_ring)) {
+		ring_pop(&sample_ring);
+		if (gap_samples < 0xFFFF) {
+			gap_samples++;
+		}
+	}
+}
+
+// Host feeds its predictor with the same samples when it receives the report
+static void update_predictor() {
+	if (predictor_reset_pending) {
+		predictor_reset(&predictor);
+		predictor_reset_pending = false;
+	}
+	uint32_t distance = gap_samples + 1;
+	for (uint32_t i = sample_ring.tail; i != sample_ring.head; i++) {
+		predictor_add(&predictor, distance, &sample_queue[i & (SAMPLE_QUEUE_SIZE - 1)]);
+		distance = 1;
+	}
+	gap_samples = 0;
+}
+
+static bool communicate_task(Task *task) {
+	static Task exchange;
 	static int acceptable_count = 0;
-	int failed_count = 0;
-	static int rand_delay_index = 0;
+	static uint8_t seq = 0;
+	static int failed_count;
+	TASK_BEGIN(task);
+	failed_count = 0;
+	seq++;
+	report_count++;
 	radio_start();
+	NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk | RADIO_INTENSET_BCMATCH_Msk;
 	while (true) {
-		
-		if (exchange_packets(temp, voltage)) {
-			if (failed_count <= FAILED_COUNT_ACCEPTABLE && power_level > 0) {
+		exchange_prepare(seq, failed_count);
+		// Packet is ready, TX waits only for the rest of the crystal start-up
+		TASK_WAIT_UNTIL(task, hfclk_started);
+		TASK_SPAWN(task, &exchange, exchange_task);
+		if (exchange_acked) {
+			acked_sample = sample_queue[(sample_ring.head - 1) & (SAMPLE_QUEUE_SIZE - 1)];
+			acked_sample_valid = true;
+			time_since_report_ms = 0;
+			update_predictor();
+			predictor_sync_dongle(&predictor_reset_pending, ack_flags);
+			while (!ring_empty(&sample_ring)) {
+				ring_pop(&sample_ring);
+			}
+			if (host_rssi != 0) {
+				// Closed loop: jump directly to the right level
+				int new_level = power_level_for_rssi(power_level, host_rssi);
+				if (new_level < power_level_min) {
+					new_level = power_level_min;
+				} else if (new_level > power_level_max) {
+					new_level = power_level_max;
+				}
+				if (new_level != power_level) {
+					LOG_INF("Host RSSI -%d dBm, changing power %d dBm -> %d dBm.\n",
+						host_rssi, power_levels_dbm[power_level], power_levels_dbm[new_level]);
+					power_level = new_level;
+				}
+				acceptable_count = 0;
+			} else if (failed_count <= FAILED_COUNT_ACCEPTABLE && power_level > power_level_min) {
 				acceptable_count++;
 				if (acceptable_count >= ACCEPTABLE_COUNT_TO_POWER_DECREASE) {
-					SEGGER_RTT_printf(0, "Decreasing power level.\n");
+					LOG_INF("Decreasing power level.\n");
 					power_level--;
 					acceptable_count = 0;
 				} else {
-					SEGGER_RTT_printf(0, "Consequtive acceptable transactions %d of %d.\n",
+					LOG_TRC("Consequtive acceptable transactions %d of %d.\n",
 						acceptable_count, ACCEPTABLE_COUNT_TO_POWER_DECREASE);
 				}
 			}
@@ -255,93 +692,921 @@ static void communicate(int16_t temp, int16_t voltage) {
 			acceptable_count = 0;
 		}
 		
-		if (failed_count == FAILED_COUNT_INCREASE_POWER && power_level < POWER_LEVEL_MAX) {
-			SEGGER_RTT_printf(0, "Increasing power level.\n");
+		if (failed_count == FAILED_COUNT_INCREASE_POWER && power_level < power_level_max) {
+			LOG_INF("Increasing power level.\n");
 			power_level++;
-		} else if (failed_count == FAILED_COUNT_FULL_POWER && power_level < POWER_LEVEL_MAX) {
-			SEGGER_RTT_printf(0, "Setting maximum power level.\n");
-			power_level = POWER_LEVEL_MAX;
+		} else if (failed_count == FAILED_COUNT_FULL_POWER && power_level < power_level_max) {
+			LOG_WRN("Setting maximum power level.\n");
+			power_level = power_level_max;
 		} else if (failed_count >= FAILED_COUNT_GIVE_UP) {
-			SEGGER_RTT_printf(0, "Communication failed.\n");
+			LOG_ERR("Communication failed.\n");
+			report_failed_count++;
+			// Host may be gone with our slot, jitter resumes until it assigns one again
+			slot_assigned = false;
+			// Host may have got the report and fed its predictor, so both restart it with the next report
+			predictor_reset_pending = true;
 			break;
 		}
-		int delay_time = RETRY_DELAY_MS;
-		delay_time += 100 * ((packet[rand_delay_index >> 3] >> (rand_delay_index & 7)) & 3);
-		delay_time += 200 * (failed_count - 1);
-		rand_delay_index += 2;
-		if (rand_delay_index >= 48) {
-			rand_delay_index = 0;
-		}
-		SEGGER_RTT_printf(0, "Packet exchange failed. Retry after %dms\n", delay_time * 100);
-		delay_ms(delay_time);
+		uint32_t delay_time = backoff_delay_ms(failed_count, random_bits(2));
+		LOG_DBG("Packet exchange failed. Retry after %dms\n", delay_time);
+		rtc_timer_start(&retry_timer, rtc_now() + delay_time * 1024 / 125, 0);
+		TASK_WAIT_UNTIL(task, rtc_timer_expired(&retry_timer));
 	}
 	radio_stop();
+	TASK_END(task);
 }
 
 
-static void recv() {
-	radio_start();
+#if defined(BUILD_MODE_HOST)
 
-	NRF_RADIO->TXPOWER = power_levels[POWER_LEVEL_MAX];
+typedef struct {
+	OutputPacket packet;
+	uint32_t time;
+	uint8_t rssi;     // -dBm
+} ReceivedPacket;
+
+typedef enum {
+	HOST_STATE_RX,          // Listening
+	HOST_STATE_REJECT,      // Invalid packet, radio is disabling, ACK chain canceled
+	HOST_STATE_TURNAROUND,  // Valid packet, radio is disabling, ACK chain is starting
+	HOST_STATE_TX,          // ACK chain is running: TIMER0 delay, TXEN, transmission, or ACK was late and is disabled
+} HostState;
+
+typedef enum {
+	DOWNLINK_FREE,
+	DOWNLINK_PENDING,    // Attached to each ACK sent to the dongle
+	DOWNLINK_DELIVERED,  // Confirmed by the dongle, waiting to be reported
+} DownlinkState;
+
+// Commands waiting for the next report of a dongle
+typedef struct {
+	volatile DownlinkState state;
+	uint32_t address_low;
+	uint16_t address_high;
+	uint8_t id;          // 0 until the next report of the dongle
+	uint8_t length;
+	uint8_t data[INPUT_DATA_MAX];
+} Downlink;
+
+#define RX_QUEUE_SIZE 16
+#define DOWNLINK_QUEUE_SIZE 8
+#define COMMAND_LINE_MAX 64
+#define GAP_FILL_MAX 1024 // Longer gaps are not filled in
+#define RECORD_BUFFER_SIZE 1024
+// PPI channels and group used by the ACK chain
+static const int PPI_CH_ACK_DELAY = 0;  // RADIO DISABLED -> TIMER0 START
+static const int PPI_CH_ACK_TXEN = 1;   // TIMER0 COMPARE[0] -> RADIO TXEN
+static const int PPI_CH_ACK_ONCE = 2;   // TIMER0 COMPARE[0] -> disable group (no restart after TX)
+static const int PPI_GROUP_ACK = 0;
+// ACK must be in place before the radio reads PACKETPTR at START (TXEN + ramp-up),
+// with a margin for the ramp-up spread and the write. Later ACKs are not sent.
+static const uint32_t ACK_DEADLINE_US = ACK_DELAY_US + RADIO_RAMP_UP_US - 20;
+
+// Queue entries are also the radio RX buffers: the next packet is received directly
+// into the head entry, so a packet is never copied between the radio and the main loop.
+static ReceivedPacket rx_queue[RX_QUEUE_SIZE];
+static Ring rx_ring;
+// Receives packets while the queue is full, so duplicates can still be ACKed
+static OutputPacket rx_spare;
+static OutputPacket *rx_buffer; // Current radio RX buffer
+__attribute__((aligned(4)))
+static InputPacket ack_packet;
+static volatile HostState host_state;
+static volatile uint32_t rx_invalid_count = 0;
+static volatile uint32_t rx_dropped_count = 0;
+static volatile uint32_t rx_packet_count = 0;
+static volatile uint32_t rx_duplicate_count = 0;
+static volatile uint32_t ack_late_count = 0;
+static volatile uint32_t ack_prepare_max_us = 0; // Longest time from DISABLED to the ACK in place
+static uint32_t records_dropped_count = 0;
+static char record_buffer[RECORD_BUFFER_SIZE];
+static Downlink downlinks[DOWNLINK_QUEUE_SIZE];
+static uint8_t downlink_last_id = 0;
+static char command_line[COMMAND_LINE_MAX];
+static int command_line_length = 0;
+static RtcTimer command_poll_timer;
+
+// Hardware-timed ACK: END -> DISABLE (short), DISABLED -> TIMER0 -> TXEN (PPI).
+// The CPU only prepares ACK contents and cancels the chain for packets that must not be ACKed.
+// TIMER0 runs until ACK_DEADLINE_US, so the ISR can tell if the ACK was ready in time.
+static void host_ack_chain_setup() {
+	NRF_TIMER0->MODE = TIMER_MODE_MODE_Timer;
+	NRF_TIMER0->BITMODE = TIMER_BITMODE_BITMODE_16Bit;
+	NRF_TIMER0->PRESCALER = 4;
+	NRF_TIMER0->CC[0] = ACK_DELAY_US;
+	NRF_TIMER0->CC[1] = ACK_DEADLINE_US;
+	NRF_TIMER0->SHORTS = TIMER_SHORTS_COMPARE1_STOP_Msk;
+	NRF_TIMER0->TASKS_CLEAR = 1;
+
+	NRF_PPI->CH[PPI_CH_ACK_DELAY].EEP = (uint32_t)&NRF_RADIO->EVENTS_DISABLED;
+	NRF_PPI->CH[PPI_CH_ACK_DELAY].TEP = (uint32_t)&NRF_TIMER0->TASKS_START;
+	NRF_PPI->CH[PPI_CH_ACK_TXEN].EEP = (uint32_t)&NRF_TIMER0->EVENTS_COMPARE[0];
+	NRF_PPI->CH[PPI_CH_ACK_TXEN].TEP = (uint32_t)&NRF_RADIO->TASKS_TXEN;
+	NRF_PPI->CH[PPI_CH_ACK_ONCE].EEP = (uint32_t)&NRF_TIMER0->EVENTS_COMPARE[0];
+	NRF_PPI->CH[PPI_CH_ACK_ONCE].TEP = (uint32_t)&NRF_PPI->TASKS_CHG[PPI_GROUP_ACK].DIS;
+	NRF_PPI->CHG[PPI_GROUP_ACK] = 1 << PPI_CH_ACK_DELAY;
+	NRF_PPI->CHENSET = (1 << PPI_CH_ACK_TXEN) | (1 << PPI_CH_ACK_ONCE);
+}
 
-	while (1) {
-		SEGGER_RTT_printf(0, "Enable RX\n");
+static void host_rx_enable() {
+	host_state = HOST_STATE_RX;
+	NRF_TIMER0->TASKS_STOP = 1;
+	NRF_TIMER0->TASKS_CLEAR = 1;
+	NRF_TIMER0->EVENTS_COMPARE[0] = 0;
+	if (ring_full(&rx_ring, RX_QUEUE_SIZE)) {
+		rx_buffer = &rx_spare;
+	} else {
+		rx_buffer = &rx_queue[ring_head(&rx_ring, RX_QUEUE_SIZE)].packet;
+	}
+	NRF_RADIO->PACKETPTR = (uint32_t)rx_buffer;
+	NRF_PPI->CHENSET = 1 << PPI_CH_ACK_DELAY;
+	NRF_RADIO->TASKS_RXEN = 1;
+}
+
+// Cancels the ACK chain. If TXEN was already triggered, the radio is disabled, and RX is
+// enabled again at that DISABLED. DISABLED of the received packet has been before TXEN.
+static void host_ack_cancel() {
+	NRF_PPI->CHENCLR = 1 << PPI_CH_ACK_DELAY;
+	NRF_TIMER0->TASKS_STOP = 1;
+	if (NRF_TIMER0->EVENTS_COMPARE[0]) {
+		NRF_RADIO->EVENTS_DISABLED = 0;
+		NRF_RADIO->TASKS_DISABLE = 1;
+		host_state = HOST_STATE_TX;
+		if (NRF_RADIO->STATE == RADIO_STATE_STATE_Disabled) {
+			// Whole transmission was over already
+			host_rx_enable();
+		}
+	} else {
+		host_state = HOST_STATE_REJECT;
+	}
+}
+
+// ACK is in place: checks if it was before the deadline, TIMER0 stops there
+static bool host_ack_in_time() {
+	NRF_TIMER0->TASKS_CAPTURE[2] = 1;
+	uint32_t elapsed = NRF_TIMER0->CC[2];
+	if (elapsed > ack_prepare_max_us) {
+		ack_prepare_max_us = elapsed;
+	}
+	return elapsed < ACK_DEADLINE_US;
+}
+
+// Shift of the dongle's next report, so it starts at the beginning of its TDMA slot.
+// Each dongle gets a slot by its registry index. Correction is based on actual arrival
+// time of a report, so it compensates dongle's clock drift and awake time variations.
+// Period is the interval in the report, so slots are right also for dongles the host did not configure.
+// Slots are at least SLOT_MIN_TICKS long, so at short intervals there are fewer slots
+// than registry entries and dongles with the same index modulo the slot count share one.
+// "now" is the whole 64-bit time, its 32-bit wrap is not a multiple of the period.
+static int32_t host_slot_correction(const Device *device, uint64_t now) {
+	int32_t period = device->interval_ms * 1024 / 125;
+	uint32_t slots = period / SLOT_MIN_TICKS;
+	if (slots > REGISTRY_CAPACITY) {
+		slots = REGISTRY_CAPACITY;
+	}
+	int32_t slot_start = (registry_index(device) % slots) * (period / slots);
+	int32_t correction = slot_start - (int32_t)(now % period);
+	if (correction > period / 2) {
+		correction -= period;
+	} else if (correction < -period / 2) {
+		correction += period;
+	}
+	return correction;
+}
+
+static Downlink *host_downlink_find(uint32_t address_low, uint16_t address_high, DownlinkState state) {
+	for (int i = 0; i < DOWNLINK_QUEUE_SIZE; i++) {
+		Downlink *downlink = &downlinks[i];
+		if (downlink->state == state && downlink->address_low == address_low && downlink->address_high == address_high) {
+			return downlink;
+		}
+	}
+	return NULL;
+}
+
+// Dongle reports id of the last downlink it applied, so delivery is confirmed by its next report.
+// New commands get their id here, different from the reported one. Ids assigned earlier
+// cannot be trusted, the dongle may have applied the same id before the host restarted.
+static void host_downlink_confirm(Device *device, const OutputPacket *p) {
+	device->downlink_id = p->downlink_id;
+	Downlink *downlink = host_downlink_find(p->address_low, p->address_high, DOWNLINK_PENDING);
+	if (downlink == NULL) {
+		return;
+	}
+	if (downlink->id == 0) {
+		do {
+			downlink_last_id = downlink_last_id == 255 ? 1 : downlink_last_id + 1;
+		} while (downlink_last_id == p->downlink_id);
+		downlink->id = downlink_last_id;
+		return;
+	}
+	if (downlink->id != p->downlink_id) {
+		return;
+	}
+	downlink->state = DOWNLINK_DELIVERED;
+}
+
+static void host_prepare_ack(Device *device, const OutputPacket *p, uint8_t rssi, uint64_t now) {
+	ack_packet.address_low = p->address_low;
+	ack_packet.address_high = p->address_high;
+	ack_packet.rssi = rssi;
+	ack_packet.flags = INPUT_FLAG_ACK;
+	ack_packet.slot_correction = 0;
+	ack_packet.downlink_id = 0;
+	ack_packet.length = INPUT_HEADER_LENGTH;
+	if ((p->flags & OUTPUT_FLAG_ATTEMPT_Msk) == 0) {
+		// Retransmissions are delayed by the retry backoff, so only first attempts give the phase
+		ack_packet.flags |= INPUT_FLAG_SLOT;
+		ack_packet.slot_correction = host_slot_correction(device, now);
+	}
+	if (predictor_sync_host(&device->predictor_synced, p->flags)) {
+		// Host is new to the dongle, restarted or evicted it, until the dongle confirms a restart
+		ack_packet.flags |= INPUT_FLAG_RESET;
+	}
+	Downlink *downlink = host_downlink_find(p->address_low, p->address_high, DOWNLINK_PENDING);
+	if (downlink != NULL) {
+		ack_packet.flags |= INPUT_FLAG_DOWNLINK;
+		ack_packet.downlink_id = downlink->id;
+		memcpy(ack_packet.data, downlink->data, downlink->length);
+		ack_packet.length += downlink->length;
+	}
+	__DMB();
+}
+
+// Called from the END interrupt for a packet with valid CRC.
+// Returns true if it should be ACKed, ack_packet is ready then.
+static bool host_accept(const OutputPacket *p, uint8_t rssi) {
+	uint64_t now = rtc_now();
+	Device *device = registry_get(p->address_low, p->address_high, (uint32_t)now);
+	rx_packet_count++;
+	if (device->rssi_avg == 0) {
+		device->rssi_avg = rssi * 16;
+	} else {
+		device->rssi_avg = (device->rssi_avg * 7 + rssi * 16 + 4) / 8;
+	}
+	// Same limits as the dongle, slots and batch timestamps follow its actual interval
+	device->interval_ms = report_interval_clamp(p->interval);
+	host_downlink_confirm(device, p);
+	if ((device->flags & DEVICE_FLAG_SEQ_VALID) && device->seq == p->seq) {
+		// Our previous ACK was lost, just ACK again
+		rx_duplicate_count++;
+		device->duplicates++;
+		host_prepare_ack(device, p, rssi, now);
+		return true;
+	}
+	if (ring_full(&rx_ring, RX_QUEUE_SIZE)) {
+		// No ACK, so the dongle will retry when we have space again
+		rx_dropped_count++;
+		return false;
+	}
+	int attempt = p->flags & OUTPUT_FLAG_ATTEMPT_Msk;
+	device->seq = p->seq;
+	device->flags |= DEVICE_FLAG_SEQ_VALID;
+	device->temp = p->temp;
+	device->voltage = p->voltage;
+	device->retries += attempt;
+	device->link_quality = (device->link_quality * 7 + (attempt == 0 ? 255 : 0) + 4) / 8;
+	ReceivedPacket *received = &rx_queue[ring_head(&rx_ring, RX_QUEUE_SIZE)];
+	if (p != &received->packet) {
+		// Queue was full when reception started
+		memcpy(&received->packet, p, p->length + 1);
+	}
+	received->time = (uint32_t)now;
+	received->rssi = rssi;
+	ring_push(&rx_ring);
+	sched_post(EVENT_RX);
+	host_prepare_ack(device, p, rssi, now);
+	return true;
+}
+
+static void host_radio_irq() {
+	if (NRF_RADIO->EVENTS_END) {
 		NRF_RADIO->EVENTS_END = 0;
+		if (host_state == HOST_STATE_RX) {
+			bool valid = (NRF_RADIO->CRCSTATUS & RADIO_CRCSTATUS_CRCSTATUS_Msk) == RADIO_CRCSTATUS_CRCSTATUS_CRCOk &&
+				(NRF_RADIO->RXMATCH & RADIO_RXMATCH_RXMATCH_Msk) == 0 &&
+				rx_buffer->length >= OUTPUT_HEADER_LENGTH;
+			if (!valid) {
+				rx_invalid_count++;
+			}
+			uint8_t rssi = NRF_RADIO->RSSISAMPLE;
+			if (valid && host_accept(rx_buffer, rssi)) {
+				NRF_RADIO->PACKETPTR = (uint32_t)&ack_packet;
+				if (host_ack_in_time()) {
+					host_state = HOST_STATE_TURNAROUND;
+				} else {
+					// Radio may have started with the RX buffer, the dongle retries and gets a duplicate ACK
+					ack_late_count++;
+					host_ack_cancel();
+				}
+			} else {
+				// Cancel ACK chain, it may be already started by DISABLED.
+				host_ack_cancel();
+			}
+		}
+	}
+	if (NRF_RADIO->EVENTS_DISABLED) {
 		NRF_RADIO->EVENTS_DISABLED = 0;
-		NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk;
-		NRF_RADIO->INTENSET = RADIO_INTENSET_END_Msk;
-		NRF_RADIO->TASKS_RXEN = 1;
-		while (1) {
-			while (!NRF_RADIO->EVENTS_END) __WFE();
-			NRF_RADIO->EVENTS_END = 0;
-
-			if ((NRF_RADIO->CRCSTATUS & RADIO_CRCSTATUS_CRCSTATUS_Msk) != RADIO_CRCSTATUS_CRCSTATUS_CRCOk ||
-				(NRF_RADIO->RXMATCH & RADIO_RXMATCH_RXMATCH_Msk) != 0)
-			{
-				NRF_RADIO->INTENSET = RADIO_INTENSET_END_Msk;
-				NRF_RADIO->TASKS_START = 1;
-				SEGGER_RTT_printf(0, "Invalid packet received\n");
-				continue;
+		if (host_state == HOST_STATE_TURNAROUND) {
+			host_state = HOST_STATE_TX;
+		} else if (host_state == HOST_STATE_REJECT || host_state == HOST_STATE_TX) {
+			host_rx_enable();
+		}
+	}
+}
+
+static void record_write(RecordType type, const void *payload, uint8_t length) {
+	uint8_t buffer[RECORD_SIZE_MAX];
+	uint32_t size = record_encode(buffer, type, payload, length);
+	// Whole record or nothing is written, so the stream stays decodable
+	if (SEGGER_RTT_Write(RECORD_CHANNEL, buffer, size) == 0) {
+		records_dropped_count++;
+	}
+}
+
+static void record_reading(const ReceivedPacket *received, const BatchSample *sample, uint32_t time, uint8_t flags) {
+	RecordReading reading = {
+		.address_low = received->packet.address_low,
+		.address_high = received->packet.address_high,
+		.temp = sample->temp,
+		.voltage = sample->voltage,
+		.timestamp = time,
+		.seq = received->packet.seq,
+		.flags = received->packet.flags | flags,
+		.rssi = received->rssi,
+	};
+	record_write(RECORD_TYPE_READING, &reading, sizeof(reading));
+}
+
+// Older samples of a batch report, oldest first. Returns number of samples, 0 if there is no batch.
+static int host_batch_samples(const ReceivedPacket *received, BatchSample *samples, uint32_t *interval_ms) {
+	const uint8_t *data = received->packet.data;
+	int size = received->packet.length - OUTPUT_HEADER_LENGTH;
+	for (int i = 0; tlv_valid(data, i, size); i += TLV_HEADER_SIZE + data[i + 1]) {
+		const uint8_t *value = &data[i + TLV_HEADER_SIZE];
+		int length = data[i + 1];
+		if ((data[i] != UPLINK_BATCH && data[i] != UPLINK_BATCH_PACKED) || length < sizeof(BatchHeader)) {
+			continue;
+		}
+		BatchHeader header;
+		memcpy(&header, value, sizeof(header));
+		*interval_ms = header.interval;
+		value += sizeof(BatchHeader);
+		length -= sizeof(BatchHeader);
+		if (data[i] == UPLINK_BATCH_PACKED) {
+			int count = codec_decode(value, length, samples, BATCH_MAX - 1);
+			return count > 0 ? count : 0;
+		}
+		int count = length / sizeof(BatchSample);
+		if (count > BATCH_MAX - 1) {
+			count = BATCH_MAX - 1;
+		}
+		memcpy(samples, value, count * sizeof(BatchSample));
+		return count;
+	}
+	return 0;
+}
+
+static bool host_gap(const ReceivedPacket *received, GapData *gap) {
+	const uint8_t *data = received->packet.data;
+	int size = received->packet.length - OUTPUT_HEADER_LENGTH;
+	for (int i = 0; tlv_valid(data, i, size); i += TLV_HEADER_SIZE + data[i + 1]) {
+		if (data[i] == UPLINK_GAP && data[i + 1] >= sizeof(GapData)) {
+			memcpy(gap, &data[i + TLV_HEADER_SIZE], sizeof(GapData));
+			return true;
+		}
+	}
+	return false;
+}
+
+// Writes a record for each sample of the packet. Older samples of a batch are
+// timestamped back from the reception time by the sample interval. Samples skipped
+// by the dongle are filled in with the values it compared them to, and flagged.
+static void record_readings(const ReceivedPacket *received) {
+	BatchSample samples[BATCH_MAX];
+	uint32_t interval_ms = 0;
+	int count = host_batch_samples(received, samples, &interval_ms);
+	samples[count].temp = received->packet.temp;
+	samples[count].voltage = received->packet.voltage;
+	count++;
+	GapData gap = { 0 };
+	host_gap(received, &gap);
+
+	// Predictor is only used here, copy it so interrupts are not blocked by the calculations
+	__disable_irq();
+	Device *device = registry_find(received->packet.address_low, received->packet.address_high);
+	Predictor predictor;
+	if (device) {
+		predictor = device->predictor;
+	} else {
+		predictor_reset(&predictor);
+	}
+	__enable_irq();
+	if (received->packet.flags & OUTPUT_FLAG_RESET) {
+		predictor_reset(&predictor);
+	}
+	uint32_t interval = report_interval_clamp(interval_ms ? interval_ms : received->packet.interval) * 1024 / 125;
+	uint32_t oldest_time = received->time - (count - 1) * interval;
+
+	if (gap.samples <= GAP_FILL_MAX) {
+		for (int j = 1; j <= gap.samples; j++) {
+			BatchSample estimate;
+			if (gap.type == GAP_PREDICTED) {
+				if (!predictor_predict(&predictor, j, &estimate)) {
+					break;
+				}
+			} else if (predictor.count > 0) {
+				estimate = predictor.samples[0];
 			} else {
 				break;
 			}
+			record_reading(received, &estimate, oldest_time - (gap.samples + 1 - j) * interval, RECORD_FLAG_ESTIMATED);
 		}
-		SEGGER_RTT_printf(0, "Received\n");
+	}
+	uint32_t distance = gap.samples + 1;
+	for (int k = 0; k < count; k++) {
+		record_reading(received, &samples[k], oldest_time + k * interval, 0);
+		predictor_add(&predictor, distance, &samples[k]);
+		distance = 1;
+	}
 
-		SEGGER_RTT_printf(0, "Packet from %04X%08X\n", output_packet->address_high, output_packet->address_low);
-		int t = output_packet->temp;
-		SEGGER_RTT_printf(0, "Temperature: %d.%d%d\xB0""C\n", t / 100, (t / 10) % 10, t % 10);
-		int v = output_packet->voltage;
-		SEGGER_RTT_printf(0, "Voltage: %d.%d%dV\n", v / 100, (v / 10) % 10, v % 10);
+	__disable_irq();
+	device = registry_find(received->packet.address_low, received->packet.address_high);
+	if (device) {
+		device->predictor = predictor;
+	}
+	__enable_irq();
+}
 
-		SEGGER_RTT_printf(0, "Disable RX\n");
-		NRF_RADIO->SHORTS = 0;
-		NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
-		NRF_RADIO->TASKS_DISABLE = 1;
-		while (!NRF_RADIO->EVENTS_DISABLED) __WFE();
-		NRF_RADIO->EVENTS_DISABLED = 0;
+static Downlink *host_downlink_alloc() {
+	for (int i = 0; i < DOWNLINK_QUEUE_SIZE; i++) {
+		if (downlinks[i].state == DOWNLINK_FREE) {
+			return &downlinks[i];
+		}
+	}
+	return NULL;
+}
+
+// Deadband and prediction set the same configuration, only the last one queued is sent
+static bool host_downlink_replaces(DownlinkType type, uint8_t pending) {
+	if (type == DOWNLINK_SET_DEADBAND || type == DOWNLINK_SET_PREDICTION) {
+		return pending == DOWNLINK_SET_DEADBAND || pending == DOWNLINK_SET_PREDICTION;
+	}
+	return pending == type;
+}
+
+// One command of each kind fits in an ACK
+_Static_assert(5 * TLV_HEADER_SIZE + sizeof(uint32_t) + 2 + 1 + sizeof(DeadbandConfig) <= INPUT_DATA_MAX,
+	"Downlink commands do not fit");
+
+// Queues a command for the next report of the dongle. Command replaces a pending
+// command of the same kind, other pending commands are sent together with it.
+static bool host_downlink_add(uint32_t address_low, uint16_t address_high, DownlinkType type, const void *value, uint8_t length) {
+	bool added = false;
+	__disable_irq();
+	Downlink *downlink = host_downlink_find(address_low, address_high, DOWNLINK_PENDING);
+	if (downlink == NULL) {
+		downlink = host_downlink_alloc();
+		if (downlink != NULL) {
+			downlink->address_low = address_low;
+			downlink->address_high = address_high;
+			downlink->length = 0;
+		}
+	}
+	if (downlink != NULL) {
+		uint8_t data[INPUT_DATA_MAX];
+		int offset = 0;
+		for (int i = 0; tlv_valid(downlink->data, i, downlink->length); i += TLV_HEADER_SIZE + downlink->data[i + 1]) {
+			if (!host_downlink_replaces(type, downlink->data[i])) {
+				offset = tlv_put(data, offset, sizeof(data), downlink->data[i], &downlink->data[i + TLV_HEADER_SIZE], downlink->data[i + 1]);
+			}
+		}
+		offset = tlv_put(data, offset, sizeof(data), type, value, length);
+		if (offset >= 0) {
+			// New id at the next report, so the dongle applies the merged commands even if it has seen the previous id
+			memcpy(downlink->data, data, offset);
+			downlink->length = offset;
+			downlink->id = 0;
+			downlink->state = DOWNLINK_PENDING;
+			added = true;
+		} else if (downlink->length == 0) {
+			downlink->state = DOWNLINK_FREE;
+		}
+	}
+	__enable_irq();
+	return added;
+}
+
+static void host_report_downlinks() {
+	for (int i = 0; i < DOWNLINK_QUEUE_SIZE; i++) {
+		Downlink *downlink = &downlinks[i];
+		if (downlink->state == DOWNLINK_DELIVERED) {
+			LOG_INF("Downlink %d delivered to %04X%08X\n", downlink->id, downlink->address_high, downlink->address_low);
+			downlink->state = DOWNLINK_FREE;
+		}
+	}
+}
+
+static const char *skip_spaces(const char *s) {
+	while (*s == ' ') {
+		s++;
+	}
+	return s;
+}
+
+// Parses decimal number after optional spaces. Returns pointer after it or NULL if there is no number.
+static const char *parse_uint(const char *s, uint32_t *value) {
+	s = skip_spaces(s);
+	if (*s < '0' || *s > '9') {
+		return NULL;
+	}
+	*value = 0;
+	while (*s >= '0' && *s <= '9') {
+		*value = *value * 10 + (*s++ - '0');
+	}
+	return s;
+}
 
-		input_packet->_reserved = 0;
-		input_packet->flags = INPUT_FLAG_ACK;
-		__DMB();
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
 
-		SEGGER_RTT_printf(0, "Wait for remote switch\n");
-		delay(1);
+static void host_command_usage() {
+	LOG_INF("Commands: <address> interval <%d-%d ms> | <address> power <min 0-%d> <max 0-%d> | "
+		"<address> batch <1-%d> | <address> deadband|predict <temp> <voltage> <heartbeat ms> | <address> diag\n",
+		REPORT_INTERVAL_MIN_MS, REPORT_INTERVAL_MAX_MS, POWER_LEVEL_MAX, POWER_LEVEL_MAX, BATCH_MAX);
+}
 
-		SEGGER_RTT_printf(0, "Sending response\n");
-		NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk;
-		NRF_RADIO->INTENSET = RADIO_INTENSET_DISABLED_Msk;
-		NRF_RADIO->TASKS_TXEN = 1;
-		while (!NRF_RADIO->EVENTS_DISABLED) __WFE();
+// Commands typed on RTT channel 0, one per line:
+//   <address> interval <ms>
+//   <address> power <min level> <max level>
+//   <address> batch <samples per report>
+//   <address> deadband <temp 1/100 °C> <voltage 10 mV> <heartbeat ms, 0 - off>
+//   <address> predict <temp 1/100 °C> <voltage 10 mV> <heartbeat ms, 0 - off>
+//   <address> diag
+static void host_command(const char *line) {
+	uint32_t address_low = 0;
+	uint16_t address_high = 0;
+	int digits = 0;
+	const char *s = skip_spaces(line);
+	for (; hex_digit(*s) >= 0; s++, digits++) {
+		address_high = (address_high << 4) | (address_low >> 28);
+		address_low = (address_low << 4) | hex_digit(*s);
+	}
+	s = skip_spaces(s);
+	uint32_t a, b, c;
+	const char *next;
+	bool added;
+	if (digits == 0 || digits > 12) {
+		host_command_usage();
+		return;
 	}
+	if (strncmp(s, "interval ", 9) == 0 && parse_uint(&s[9], &a) &&
+		a >= REPORT_INTERVAL_MIN_MS && a <= REPORT_INTERVAL_MAX_MS)
+	{
+		added = host_downlink_add(address_low, address_high, DOWNLINK_SET_INTERVAL, &a, sizeof(a));
+	} else if (strncmp(s, "power ", 6) == 0 && (next = parse_uint(&s[6], &a)) && parse_uint(next, &b) &&
+		a <= b && b <= POWER_LEVEL_MAX)
+	{
+		uint8_t limits[2] = { a, b };
+		added = host_downlink_add(address_low, address_high, DOWNLINK_SET_POWER, limits, sizeof(limits));
+	} else if (strncmp(s, "batch ", 6) == 0 && parse_uint(&s[6], &a) && a >= 1 && a <= BATCH_MAX) {
+		uint8_t samples = a;
+		added = host_downlink_add(address_low, address_high, DOWNLINK_SET_BATCH, &samples, sizeof(samples));
+	} else if ((strncmp(s, "deadband ", 9) == 0 || strncmp(s, "predict ", 8) == 0) &&
+		(next = parse_uint(strchr(s, ' '), &a)) && (next = parse_uint(next, &b)) && parse_uint(next, &c) &&
+		a <= 0xFFFF && b <= 0xFFFF)
+	{
+		DeadbandConfig config = { .temp = a, .voltage = b, .heartbeat = c };
+		DownlinkType type = s[0] == 'd' ? DOWNLINK_SET_DEADBAND : DOWNLINK_SET_PREDICTION;
+		added = host_downlink_add(address_low, address_high, type, &config, sizeof(config));
+	} else if (strcmp(s, "diag") == 0) {
+		added = host_downlink_add(address_low, address_high, DOWNLINK_REQUEST_DIAG, NULL, 0);
+	} else {
+		host_command_usage();
+		return;
+	}
+	if (added) {
+		LOG_INF("Downlink queued for %04X%08X\n", address_high, address_low);
+	} else {
+		LOG_WRN("Downlink queue full\n");
+	}
+}
 
+static void host_read_commands() {
+	char c;
+	while (SEGGER_RTT_Read(0, &c, 1) == 1) {
+		if (c == '\r' || c == '\n') {
+			command_line[command_line_length] = 0;
+			if (command_line_length > 0) {
+				host_command(command_line);
+			}
+			command_line_length = 0;
+		} else if (command_line_length < COMMAND_LINE_MAX - 1) {
+			command_line[command_line_length++] = c;
+		}
+	}
 }
 
+static void host_print_uplink(const ReceivedPacket *received) {
+	const uint8_t *data = received->packet.data;
+	int size = received->packet.length - OUTPUT_HEADER_LENGTH;
+	for (int i = 0; tlv_valid(data, i, size); i += TLV_HEADER_SIZE + data[i + 1]) {
+		if (data[i] == UPLINK_DIAG && data[i + 1] >= sizeof(DiagData)) {
+			DiagData diag;
+			memcpy(&diag, &data[i + TLV_HEADER_SIZE], sizeof(diag));
+			LOG_INF("Diagnostics: interval %dms, reports %d, failed %d\n",
+				diag.interval, diag.reports, diag.failed);
+			LOG_INF("Diagnostics: power level %d (%d ... %d), ACK window %dus, batch %d\n",
+				diag.power_level, diag.power_level_min, diag.power_level_max, diag.rx_timeout, diag.batch_size);
+			LOG_INF("Diagnostics: deadband%s %d/100\xB0""C, %dmV, heartbeat %dms\n",
+				diag.prediction ? " around prediction" : "", diag.deadband_temp, diag.deadband_voltage * 10, diag.heartbeat);
+		} else if (data[i] == UPLINK_GAP && data[i + 1] >= sizeof(GapData)) {
+			GapData gap;
+			memcpy(&gap, &data[i + TLV_HEADER_SIZE], sizeof(gap));
+			LOG_DBG("Skipped samples: %d%s\n", gap.samples, gap.type == GAP_PREDICTED ? ", predicted" : "");
+		} else if (data[i] == UPLINK_BATCH || data[i] == UPLINK_BATCH_PACKED) {
+			BatchSample samples[BATCH_MAX - 1];
+			uint32_t interval_ms;
+			LOG_DBG("Batch: %d older samples in %d bytes%s\n", host_batch_samples(received, samples, &interval_ms),
+				data[i + 1], data[i] == UPLINK_BATCH_PACKED ? ", packed" : "");
+		}
+	}
+}
+
+// Formats the oldest packet of the RX queue and gives the entry back to the radio
+static void host_process_packet() {
+	static uint32_t invalid_reported = 0;
+	static uint32_t dropped_reported = 0;
+	static uint32_t duplicate_reported = 0;
+	static uint32_t ack_prepare_reported = 0;
+	static uint32_t devices_reported = 0;
+	static uint32_t records_dropped_reported = 0;
+
+	if (rx_invalid_count != invalid_reported) {
+		invalid_reported = rx_invalid_count;
+		LOG_WRN("Invalid packets received: %d\n", invalid_reported);
+	}
+	if (rx_dropped_count != dropped_reported) {
+		dropped_reported = rx_dropped_count;
+		LOG_WRN("Packets dropped (queue full): %d\n", dropped_reported);
+	}
+	if (ack_prepare_max_us != ack_prepare_reported) {
+		ack_prepare_reported = ack_prepare_max_us;
+		LOG_INF("ACK ready %dus after the packet at most (deadline %dus), %d late\n",
+			ack_prepare_reported, ACK_DEADLINE_US, ack_late_count);
+	}
+	if (rx_duplicate_count != duplicate_reported) {
+		duplicate_reported = rx_duplicate_count;
+		LOG_INF("Duplicates: %d of %d packets\n", duplicate_reported, rx_packet_count);
+	}
+
+	ReceivedPacket *received = &rx_queue[ring_tail(&rx_ring, RX_QUEUE_SIZE)];
+	record_readings(received);
+	LOG_INF("Packet from %04X%08X, seq %d\n", received->packet.address_high, received->packet.address_low,
+		received->packet.seq);
+	int t = received->packet.temp;
+	LOG_INF("Temperature: %d.%d%d\xB0""C\n", t / 100, (t / 10) % 10, t % 10);
+	int v = received->packet.voltage;
+	LOG_INF("Voltage: %d.%d%dV\n", v / 100, (v / 10) % 10, v % 10);
+	host_print_uplink(received);
+
+	__disable_irq();
+	Device *device = registry_find(received->packet.address_low, received->packet.address_high);
+	Device device_copy = device ? *device : (Device){ 0 };
+	uint32_t devices_count = registry_count();
+	__enable_irq();
+	uint8_t rssi = received->rssi;
+	// Entry is given back to the radio, do not touch it after this
+	ring_pop(&rx_ring);
+
+	LOG_DBG("RSSI: -%d dBm, average: -%d dBm\n", rssi, (device_copy.rssi_avg + 8) / 16);
+	LOG_DBG("Link quality: %d%%, retries: %d, duplicates: %d\n",
+		device_copy.link_quality * 100 / 255, device_copy.retries, device_copy.duplicates);
+	if (devices_count != devices_reported) {
+		devices_reported = devices_count;
+		LOG_INF("Known dongles: %d, evicted: %d\n", devices_count, registry_evictions());
+	}
+	if (records_dropped_count != records_dropped_reported) {
+		records_dropped_reported = records_dropped_count;
+		LOG_WRN("Records dropped (RTT buffer full): %d\n", records_dropped_reported);
+	}
+}
+
+// Radio is served by the interrupts, here we only format the output and read commands
+static bool host_task(Task *task) {
+	static Task clock_start;
+	TASK_BEGIN(task);
+	TASK_SPAWN(task, &clock_start, clock_start_task);
+
+	SEGGER_RTT_ConfigUpBuffer(RECORD_CHANNEL, "Records", record_buffer, sizeof(record_buffer), SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+
+	radio_start();
+
+	NRF_RADIO->TXPOWER = power_levels[POWER_LEVEL_MAX];
+	NRF_RADIO->SHORTS = RADIO_SHORTS_READY_START_Msk | RADIO_SHORTS_END_DISABLE_Msk |
+		RADIO_SHORTS_ADDRESS_RSSISTART_Msk | RADIO_SHORTS_DISABLED_RSSISTOP_Msk;
+	NRF_RADIO->EVENTS_END = 0;
+	NRF_RADIO->EVENTS_DISABLED = 0;
+	host_ack_chain_setup();
+	rtc_timer_start(&command_poll_timer, rtc_now() + COMMAND_POLL_TICKS, COMMAND_POLL_TICKS);
+	NRF_RADIO->INTENSET = RADIO_INTENSET_END_Msk | RADIO_INTENSET_DISABLED_Msk;
+	LOG_DBG("Enable RX\n");
+	host_rx_enable();
+
+	while (1) {
+		host_read_commands();
+		host_report_downlinks();
+		while (!ring_empty(&rx_ring)) {
+			host_process_packet();
+		}
+		TASK_WAIT_EVENT(task, EVENT_RX | EVENT_TIMER);
+	}
+	TASK_END(task);
+}
+
+#endif
+
+
+#if defined(BUILD_MODE_DONGLE)
+
+static void measure_chain_setup() {
+	NRF_PPI->CH[PPI_CH_MEASURE_TEMP].EEP = (uint32_t)&NRF_RTC0->EVENTS_COMPARE[RTC_CHANNEL_MEASURE];
+	NRF_PPI->CH[PPI_CH_MEASURE_TEMP].TEP = (uint32_t)&NRF_TEMP->TASKS_START;
+	NRF_PPI->CH[PPI_CH_MEASURE_ADC].EEP = (uint32_t)&NRF_RTC0->EVENTS_COMPARE[RTC_CHANNEL_MEASURE];
+	NRF_PPI->CH[PPI_CH_MEASURE_ADC].TEP = (uint32_t)&NRF_ADC->TASKS_START;
+	NRF_PPI->CH[PPI_CH_HFCLK_START].EEP = (uint32_t)&NRF_RTC0->EVENTS_COMPARE[RTC_CHANNEL_HFCLK];
+	NRF_PPI->CH[PPI_CH_HFCLK_START].TEP = (uint32_t)&NRF_CLOCK->TASKS_HFCLKSTART;
+	NRF_PPI->CHENSET = (1 << PPI_CH_MEASURE_TEMP) | (1 << PPI_CH_MEASURE_ADC) | (1 << PPI_CH_HFCLK_START);
+}
+
+// Learns the crystal start-up time from the last start
+static void hfclk_ramp_update() {
+	uint32_t ramp = hfclk_started_time - hfclk_start_time;
+	hfclk_ramp = (hfclk_ramp * 7 + ramp * 8 + 4) / 8;
+}
+
+static bool dongle_task(Task *task) {
+	static Task child;
+	static uint64_t next_report;
+	static uint64_t measure_time;
+	static BatchSample measured;
+	static bool hfclk_early;
+	TASK_BEGIN(task);
+	TASK_SPAWN(task, &child, clock_start_task);
+	measure_chain_setup();
+	rx_window_setup();
+	// Crystal runs only during reports
+	NRF_CLOCK->TASKS_HFCLKSTOP = 1;
+
+	// Reports are scheduled at absolute deadlines, so time spent measuring and retrying
+	// does not add up as drift. Phase is random, so dongles powered up together do not
+	// report together.
+	next_report = rtc_now() + random_bits(3) % (report_interval_ms * 1024 / 125);
+
+	while (1) {
+		// Jitter on every period, so dongles that happen to share a phase do not stay in lockstep.
+		// Dongles in TDMA slots have distinct phases, and jitter would push them out of the slot.
+		report_jitter = slot_assigned ? 0 : random_bits(1) & (REPORT_JITTER_TICKS - 1);
+		measure_time = next_report + report_jitter;
+		// Compare reaches only half of the RTC range ahead, long intervals start with a timer
+		if (measure_time > rtc_now() + RTC_COMPARE_MAX_AHEAD) {
+			rtc_timer_start(&report_timer, measure_time - RTC_COMPARE_MAX_AHEAD, 0);
+			TASK_WAIT_UNTIL(task, rtc_timer_expired(&report_timer));
+		}
+
+		hfclk_started = false;
+		hfclk_early = false;
+#		if HFCLK_EARLY_START
+		// Crystal starts up during the measurement if the batch will be full, so the
+		// radio does not wait for all of it. Measurement runs on the RC oscillator.
+		// With a deadband most batches are skipped, so only if a report is likely: heartbeat
+		// is due or the values are changing. Otherwise it starts when the report is needed.
+		if (ring_count(&sample_ring) + 1 >= batch_size && (deadband.heartbeat == 0 || !acked_sample_valid ||
+			time_since_report_ms >= deadband.heartbeat || deadband_left))
+		{
+			hfclk_start_time = measure_time - hfclk_ramp / 8 - HFCLK_MARGIN_TICKS;
+			hfclk_early = rtc_compare_start(RTC_CHANNEL_HFCLK, hfclk_start_time);
+		}
+#		endif
+
+		// TEMP and ADC start together. ADC conversion (68 us) takes longer than TEMP (36 us),
+		// so only ADC END wakes up the CPU and the temperature is ready by then.
+		NRF_ADC->ENABLE = 1;
+		NRF_TEMP->EVENTS_DATARDY = 0;
+		sched_clear(EVENT_ADC);
+		if (!rtc_compare_start(RTC_CHANNEL_MEASURE, measure_time)) {
+			// Deadline has passed
+			NRF_TEMP->TASKS_START = 1;
+			NRF_ADC->TASKS_START = 1;
+		}
+		TASK_WAIT_EVENT(task, EVENT_ADC);
+		rtc_compare_stop(RTC_CHANNEL_MEASURE);
+		NRF_ADC->ENABLE = 0;
+		measured.voltage = NRF_ADC->RESULT * 45 / 128;
+		if (!NRF_TEMP->EVENTS_DATARDY) {
+			sched_clear(EVENT_TEMP);
+			NRF_TEMP->INTENSET = TEMP_INTENSET_DATARDY_Msk;
+			TASK_WAIT_EVENT(task, EVENT_TEMP);
+			NRF_TEMP->INTENCLR = TEMP_INTENCLR_DATARDY_Msk;
+		}
+		NRF_TEMP->EVENTS_DATARDY = 0;
+		measured.temp = NRF_TEMP->TEMP * 25;
+		LOG_DBG("Temperature: %d.%d%d\xB0""C\n", measured.temp / 100, (measured.temp / 10) % 10, measured.temp % 10);
+		LOG_DBG("Voltage: %d.%d%dV\n", measured.voltage / 100, (measured.voltage / 10) % 10, measured.voltage % 10);
+
+		// Samples that did not fit in the batch are dropped, oldest first
+		if (ring_count(&sample_ring) >= BATCH_MAX) {
+			ring_pop(&sample_ring);
+			if (gap_samples < 0xFFFF) {
+				gap_samples++;
+			}
+		}
+		sample_queue[ring_head(&sample_ring, SAMPLE_QUEUE_SIZE)] = measured;
+		ring_push(&sample_ring);
+
+		// Crystal and radio are started only when there is a whole batch to send
+		if (ring_count(&sample_ring) >= batch_size && !report_needed()) {
+			LOG_DBG("No change, report skipped\n");
+			discard_samples();
+			if (hfclk_early) {
+				rtc_compare_stop(RTC_CHANNEL_HFCLK);
+				NRF_CLOCK->TASKS_HFCLKSTOP = 1;
+			}
+		} else if (ring_count(&sample_ring) >= batch_size) {
+			if (!hfclk_early) {
+				hfclk_start_time = rtc_now();
+				NRF_CLOCK->TASKS_HFCLKSTART = 1;
+			}
+
+			TASK_SPAWN(task, &child, communicate_task);
+
+			rtc_compare_stop(RTC_CHANNEL_HFCLK);
+			NRF_CLOCK->TASKS_HFCLKSTOP = 1;
+			hfclk_ramp_update();
+			{
+				uint32_t awake = rtc_now() - (hfclk_start_time < measure_time ? hfclk_start_time : measure_time);
+				LOG_INF("Awake %dus, crystal start-up %dus\n", awake * 15625 / 128,
+					(uint32_t)(hfclk_started_time - hfclk_start_time) * 15625 / 128);
+			}
+		}
+
+		LOG_TRC("Delay %dms\n", report_interval_ms);
+
+		// Host moves us to our TDMA slot and compensates clock drift. Signed sum, so a negative
+		// correction cannot wrap, and the step is never too short for the next measurement.
+		{
+			int64_t ticks = report_interval_ms * 1024 / 125;
+			int64_t step = ticks + slot_correction;
+			if (step < ticks / 2) {
+				step = ticks / 2;
+			}
+			next_report += step;
+		}
+		if (slot_correction != 0) {
+			LOG_DBG("Slot correction %d ticks\n", slot_correction);
+			slot_correction = 0;
+		}
+		time_since_report_ms += report_interval_ms;
+
+		// Retries took longer than the interval, measurements of the missed periods are lost
+		while (rtc_now() > next_report) {
+			LOG_WRN("Period missed\n");
+			next_report += report_interval_ms * 1024 / 125;
+			time_since_report_ms += report_interval_ms;
+			// Gap is only known to the host if it is before the queued samples
+			if (ring_count(&sample_ring) == 0 && gap_samples < 0xFFFF) {
+				gap_samples++;
+			}
+		}
+	}
+	TASK_END(task);
+}
+
+#endif
+
 
 int main()
 {
+	log_init();
+#	if LOG_BENCH
+	log_bench();
+#	endif
+#	if defined(BUILD_MODE_HOST)
+	// Device registry needs more than 8K of RAM
+	NRF_POWER->RAMON = POWER_RAMON_ONRAM0_RAM0On | POWER_RAMON_ONRAM1_RAM1On;
+	NRF_POWER->RAMONB = POWER_RAMONB_ONRAM2_RAM2On | POWER_RAMONB_ONRAM3_RAM3On;
+#	else
 	NRF_POWER->RAMON = POWER_RAMON_ONRAM0_RAM0On;
 	NRF_POWER->RAMONB = 0;
+#	endif
 	NVIC_EnableIRQ(POWER_CLOCK_IRQn);
 	NVIC_SetPriority(POWER_CLOCK_IRQn, 0);
 //#	if defined(BUILD_MODE_DONGLE)
@@ -351,8 +1616,6 @@ int main()
 		NVIC_SetPriority(RTC0_IRQn, 0);
 		NVIC_EnableIRQ(ADC_IRQn);
 		NVIC_SetPriority(ADC_IRQn, 0);
-		NRF_RTC0->PRESCALER = 3;
-		NRF_RTC0->EVTENSET = RTC_EVTENSET_COMPARE0_Msk;
 		NRF_ADC->CONFIG = 
 			(ADC_CONFIG_RES_10bit << ADC_CONFIG_RES_Pos) |
 			(ADC_CONFIG_INPSEL_SupplyOneThirdPrescaling << ADC_CONFIG_INPSEL_Pos) |
@@ -361,67 +1624,16 @@ int main()
 	NVIC_EnableIRQ(RADIO_IRQn);
 	NVIC_SetPriority(RADIO_IRQn, 0);
 
-	__enable_irq();
+	NRF_CLOCK->INTENSET = CLOCK_INTENSET_HFCLKSTARTED_Msk | CLOCK_INTENSET_LFCLKSTARTED_Msk;
+	NRF_ADC->INTENSET = ADC_INTENSET_END_Msk;
 
-	SEGGER_RTT_printf(0, "Setting up the clock\n");
-
-	NRF_CLOCK->INTENSET = CLOCK_INTENSET_HFCLKSTARTED_Msk;
-	NRF_CLOCK->TASKS_HFCLKSTART = 1;
-	while (!NRF_CLOCK->EVENTS_HFCLKSTARTED) __WFE();
-	NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
-
-	NRF_CLOCK->INTENSET = CLOCK_INTENSET_LFCLKSTARTED_Msk;
-	NRF_CLOCK->LFCLKSRC = CLOCK_LFCLKSRC_SRC_Xtal;
-	NRF_CLOCK->TASKS_LFCLKSTART = 1;
-	while (!NRF_CLOCK->EVENTS_LFCLKSTARTED) __WFE();
-	NRF_CLOCK->EVENTS_LFCLKSTARTED = 0;
-
-	SEGGER_RTT_printf(0, "DONE\n");
+	__enable_irq();
 
 #	if defined(BUILD_MODE_DONGLE)
-
-	while(1)
-	{
-		SEGGER_RTT_printf(0, "Measuring temp\n");
-		NRF_TEMP->INTENSET = TEMP_INTENSET_DATARDY_Msk;
-		NRF_TEMP->TASKS_START = 1;
-		while (!NRF_TEMP->EVENTS_DATARDY) __WFE();
-		NRF_TEMP->EVENTS_DATARDY = 0;
-		int t = NRF_TEMP->TEMP * 25;
-		SEGGER_RTT_printf(0, "Temperature: %d.%d%d\xB0""C\n", t / 100, (t / 10) % 10, t % 10);
-
-		SEGGER_RTT_printf(0, "Measuring battery\n");
-		NRF_ADC->ENABLE = 1;
-		NRF_ADC->INTENSET = ADC_INTENSET_END_Msk;
-		NRF_ADC->TASKS_START = 1;
-		while (!NRF_ADC->EVENTS_END) __WFE();
-		NRF_ADC->EVENTS_END = 0;
-		NRF_ADC->ENABLE = 0;
-		int v = NRF_ADC->RESULT * 45 / 128;
-		SEGGER_RTT_printf(0, "Voltage: %d.%d%dV\n", v / 100, (v / 10) % 10, v % 10);
-
-		communicate(t, v);
-
-		SEGGER_RTT_printf(0, "Delay %dms\n", REPORT_INTERVAL_MS);
-
-		while (!(NRF_CLOCK->HFCLKSTAT & CLOCK_HFCLKSTAT_STATE_Msk)) {
-			delay(2);
-		}
-		NRF_CLOCK->TASKS_HFCLKSTOP = 1;
-
-		delay_ms(REPORT_INTERVAL_MS);
-
-		NRF_CLOCK->INTENSET = CLOCK_INTENSET_HFCLKSTARTED_Msk;
-		NRF_CLOCK->TASKS_HFCLKSTART = 1;
-		while (!NRF_CLOCK->EVENTS_HFCLKSTARTED) __WFE();
-		NRF_CLOCK->EVENTS_HFCLKSTARTED = 0;
-	}
+	static Task task = { .run = dongle_task };
 #	else
-
-	while (1) {
-		recv();
-	}
-
+	static Task task = { .run = host_task };
 #	endif
+	sched_add(&task);
+	sched_run();
 }
-
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "predictor.h"
+
+static const uint32_t AGE_MAX = 0xFFFF;
+
+void predictor_reset(Predictor *predictor) {
+	memset(predictor, 0, sizeof(Predictor));
+}
+
+void predictor_add(Predictor *predictor, uint32_t distance, const BatchSample *sample) {
+	int count = predictor->count < PREDICTOR_HISTORY ? predictor->count + 1 : PREDICTOR_HISTORY;
+	for (int i = count - 1; i > 0; i--) {
+		uint32_t age = predictor->age[i - 1] + distance;
+		predictor->age[i] = age < AGE_MAX ? age : AGE_MAX;
+		predictor->samples[i] = predictor->samples[i - 1];
+	}
+	predictor->age[0] = 0;
+	predictor->samples[0] = *sample;
+	predictor->count = count;
+}
+
+// Rounded to nearest, ties away from zero
+static int64_t divide_rounded(int64_t num, int64_t den) {
+	if (den < 0) {
+		num = -num;
+		den = -den;
+	}
+	return num >= 0 ? (num + den / 2) / den : -((-num + den / 2) / den);
+}
+
+static int16_t saturate(int64_t value) {
+	return value > INT16_MAX ? INT16_MAX : value < INT16_MIN ? INT16_MIN : value;
+}
+
+static int16_t sample_value(const BatchSample *sample, bool voltage) {
+	return voltage ? sample->voltage : sample->temp;
+}
+
+// Line through points (-age[i], y[i]) evaluated at x:
+// y(x) = (Sy * D + (n * Sxy - Sx * Sy) * (n * x - Sx)) / (n * D), where D = n * Sxx - Sx * Sx
+static int16_t predict_series(const Predictor *predictor, bool voltage, int64_t x) {
+	int64_t n = predictor->count;
+	int64_t sx = 0;
+	int64_t sy = 0;
+	int64_t sxx = 0;
+	int64_t sxy = 0;
+	for (int i = 0; i < predictor->count; i++) {
+		int64_t xi = -(int64_t)predictor->age[i];
+		int64_t yi = sample_value(&predictor->samples[i], voltage);
+		sx += xi;
+		sy += yi;
+		sxx += xi * xi;
+		sxy += xi * yi;
+	}
+	int64_t d = n * sxx - sx * sx;
+	if (d == 0) {
+		// Single point, or all at the same time: hold the newest value
+		return sample_value(&predictor->samples[0], voltage);
+	}
+	return saturate(divide_rounded(sy * d + (n * sxy - sx * sy) * (n * x - sx), n * d));
+}
+
+bool predictor_predict(const Predictor *predictor, uint32_t distance, BatchSample *prediction) {
+	if (predictor->count == 0) {
+		return false;
+	}
+	if (distance > AGE_MAX) {
+		distance = AGE_MAX;
+	}
+	prediction->temp = predict_series(predictor, false, distance);
+	prediction->voltage = predict_series(predictor, true, distance);
+	return true;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "protocol.h"
+
+// Linear trend predictor run in the same way on the dongle and on the host.
+// Both feed it with the same acknowledged samples, so they get the same
+// predictions without exchanging them. Integer only, so results do not depend
+// on the CPU.
+
+#define PREDICTOR_HISTORY 4
+
+typedef struct {
+	BatchSample samples[PREDICTOR_HISTORY]; // Newest first
+	uint16_t age[PREDICTOR_HISTORY];        // Sample intervals before the newest sample
+	uint8_t count;
+} Predictor;
+
+void predictor_reset(Predictor *predictor);
+
+// Adds a sample taken "distance" sample intervals after the newest sample in the history.
+void predictor_add(Predictor *predictor, uint32_t distance, const BatchSample *sample);
+
+// Predicts a sample "distance" sample intervals after the newest sample, using a least
+// squares line through the history. Returns false if the history is empty.
+bool predictor_predict(const Predictor *predictor, uint32_t distance, BatchSample *prediction);
+
+// Restart handshake, also used by tools/predictor_sync_sim. Host asks the dongle to restart
+// (INPUT_FLAG_RESET in every ACK, also for retransmissions) until a report with OUTPUT_FLAG_RESET
+// confirms that both restarted the predictor from its samples.
+
+// Host side, for each report of the dongle. "synced" is false for a dongle the host
+// has no predictor history of. Returns true if the ACK must carry INPUT_FLAG_RESET.
+static inline bool predictor_sync_host(bool *synced, uint8_t output_flags) {
+	if (output_flags & OUTPUT_FLAG_RESET) {
+		*synced = true;
+	}
+	return !*synced;
+}
+
+// Dongle side, after the acknowledged report was added to the predictor.
+// Restart is done with the next report, so the host knows when it happened.
+static inline void predictor_sync_dongle(bool *reset_pending, uint16_t input_flags) {
+	if (input_flags & INPUT_FLAG_RESET) {
+		*reset_pending = true;
+	}
+}
+
+#endif
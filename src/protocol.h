@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Radio frames exchanged between dongles and the host.
+//
+// Frames have variable length: the first byte is the radio LENGTH field (number
+// of bytes after it), so fields after it are aligned in RAM. Fixed header is
+// followed by TLV items: type (1 byte), value length (1 byte), value.
+
+#define OUTPUT_DATA_MAX 96
+#define INPUT_DATA_MAX 32
+#define BATCH_MAX 16 // Samples in one report, including the one in the header
+
+// Report sent by a dongle
+typedef struct {
+	uint8_t length;
+	uint8_t seq;            // Incremented on each new report, same for retransmissions
+	uint16_t address_high;
+	uint32_t address_low;
+	uint32_t interval;      // Report interval in ms, host assigns slots within it
+	int16_t temp;           // 1/100 °C, newest sample
+	int16_t voltage;        // 10 mV
+	uint8_t flags;          // OUTPUT_FLAG_*
+	uint8_t downlink_id;    // Id of the last downlink applied by the dongle
+	uint8_t data[OUTPUT_DATA_MAX]; // UPLINK_* items
+} OutputPacket;
+
+// ACK sent by the host
+typedef struct {
+	uint8_t length;
+	uint8_t rssi;           // -dBm of the ACKed packet measured by the host, 0 - unknown
+	uint16_t address_high;
+	uint32_t address_low;
+	int32_t slot_correction; // RTC ticks to add to the next report interval (with INPUT_FLAG_SLOT), up to half of it, larger ones are ignored
+	uint16_t flags;         // INPUT_FLAG_*
+	uint8_t downlink_id;    // Id of the commands in data (with INPUT_FLAG_DOWNLINK)
+	uint8_t data[INPUT_DATA_MAX]; // DOWNLINK_* items
+} InputPacket;
+
+#define OUTPUT_HEADER_LENGTH (offsetof(OutputPacket, data) - 1)
+#define INPUT_HEADER_LENGTH (offsetof(InputPacket, data) - 1)
+#define FRAME_MAX_LENGTH (sizeof(OutputPacket) > sizeof(InputPacket) ? sizeof(OutputPacket) - 1 : sizeof(InputPacket) - 1)
+
+static const uint16_t INPUT_FLAG_ACK = 0x8000;
+static const uint16_t INPUT_FLAG_SLOT = 0x4000;
+static const uint16_t INPUT_FLAG_DOWNLINK = 0x2000;
+static const uint16_t INPUT_FLAG_RESET = 0x1000; // Host has no predictor history, dongle restarts its predictor with the next report
+static const uint8_t OUTPUT_FLAG_ATTEMPT_Msk = 0x07; // Number of failed attempts before this one (saturated)
+static const uint8_t OUTPUT_FLAG_RESET = 0x08; // Dongle restarted its predictor (predictor.h), host must do the same
+
+// Limits of the report interval set by the host, the dongle clamps DOWNLINK_SET_INTERVAL to them
+static const uint32_t REPORT_INTERVAL_MIN_MS = 1000;
+static const uint32_t REPORT_INTERVAL_MAX_MS = 30 * 60 * 1000;
+
+// Commands for a dongle in InputPacket data
+typedef enum {
+	DOWNLINK_SET_INTERVAL = 1,  // uint32_t report interval in ms, REPORT_INTERVAL_MIN_MS ... REPORT_INTERVAL_MAX_MS
+	DOWNLINK_SET_POWER = 2,     // uint8_t minimum and uint8_t maximum TX power level
+	DOWNLINK_REQUEST_DIAG = 3,  // No value, dongle sends UPLINK_DIAG in the next report
+	DOWNLINK_SET_BATCH = 4,     // uint8_t samples per report, 1 ... BATCH_MAX
+	DOWNLINK_SET_DEADBAND = 5,  // DeadbandConfig
+	DOWNLINK_SET_PREDICTION = 6, // DeadbandConfig, deadband around the predicted value (predictor.h)
+} DownlinkType;
+
+// Additional items in OutputPacket data
+typedef enum {
+	UPLINK_DIAG = 1,            // DiagData
+	UPLINK_BATCH = 2,           // BatchHeader, then BatchSample for each older sample, oldest first
+	UPLINK_BATCH_PACKED = 3,    // BatchHeader, then older samples encoded with codec.h
+	UPLINK_GAP = 4,             // GapData
+} UplinkType;
+
+typedef struct __attribute__((packed)) {
+	uint32_t interval;          // Report interval in ms
+	uint16_t reports;           // Reports since reset
+	uint16_t failed;            // Failed exchanges since reset
+	uint8_t power_level;
+	uint8_t power_level_min;
+	uint8_t power_level_max;
+	uint16_t rx_timeout;        // ACK window in us
+	uint8_t batch_size;
+	uint16_t deadband_temp;
+	uint16_t deadband_voltage;
+	uint32_t heartbeat;
+	uint8_t prediction;         // Deadband is around the predicted value
+} DiagData;
+
+// Report-on-change: samples are sent only if one of them differs from the last
+// acknowledged value by more than the deadband, or if heartbeat time has passed.
+typedef struct __attribute__((packed)) {
+	uint16_t temp;              // 1/100 °C
+	uint16_t voltage;           // 10 mV
+	uint32_t heartbeat;         // Maximum time between reports in ms, 0 = report every sample
+} DeadbandConfig;
+
+typedef enum {
+	GAP_DEADBAND = 0,           // Skipped samples were in the deadband around the last reported sample
+	GAP_PREDICTED = 1,          // Skipped samples were in the deadband around the predicted values
+} GapType;
+
+// Samples skipped since the previous acknowledged report, before the oldest sample of this one
+typedef struct __attribute__((packed)) {
+	uint16_t samples;
+	uint8_t type;               // GapType
+} GapData;
+
+typedef struct __attribute__((packed)) {
+	uint32_t interval;          // Time between samples in ms, the newest sample is in the packet header
+} BatchHeader;
+
+typedef struct __attribute__((packed)) {
+	int16_t temp;
+	int16_t voltage;
+} BatchSample;
+
+static inline uint32_t report_interval_clamp(uint32_t interval_ms) {
+	if (interval_ms < REPORT_INTERVAL_MIN_MS) {
+		return REPORT_INTERVAL_MIN_MS;
+	} else if (interval_ms > REPORT_INTERVAL_MAX_MS) {
+		return REPORT_INTERVAL_MAX_MS;
+	}
+	return interval_ms;
+}
+
+#define TLV_HEADER_SIZE 2
+
+// Appends TLV item at "offset" of "data". Returns new offset or -1 if it does not fit.
+static inline int tlv_put(uint8_t *data, int offset, int size, uint8_t type, const void *value, uint8_t length) {
+	if (offset + TLV_HEADER_SIZE + length > size) {
+		return -1;
+	}
+	data[offset] = type;
+	data[offset + 1] = length;
+	const uint8_t *src = (const uint8_t *)value;
+	for (int i = 0; i < length; i++) {
+		data[offset + TLV_HEADER_SIZE + i] = src[i];
+	}
+	return offset + TLV_HEADER_SIZE + length;
+}
+
+// True if a complete TLV item starts at "offset". Iterate over items with:
+// for (int i = 0; tlv_valid(data, i, size); i += TLV_HEADER_SIZE + data[i + 1])
+static inline bool tlv_valid(const uint8_t *data, int offset, int size) {
+	return offset + TLV_HEADER_SIZE <= size && offset + TLV_HEADER_SIZE + data[offset + 1] <= size;
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Binary record stream sent by the host on RTT up-buffer RECORD_CHANNEL.
+// Decoded on Linux by tools/rtt_decode.
+//
+// Each record is: RecordHeader, "length" bytes of payload, checksum.
+// Checksum is the inverted 8-bit sum of header and payload bytes.
+// New fields are only appended to payloads, so decoders accept longer payloads.
+// All values are little endian.
+
+#define RECORD_CHANNEL 1
+#define RECORD_SYNC 0xA5
+#define RECORD_PAYLOAD_MAX 64
+#define RECORD_TICKS_PER_SECOND 8192
+#define RECORD_FLAG_ESTIMATED 0x80 // Sample was not sent by the dongle, value is filled in by the host
+
+typedef enum {
+	RECORD_TYPE_READING = 1,
+} RecordType;
+
+typedef struct __attribute__((packed)) {
+	uint8_t sync;
+	uint8_t type;     // RecordType
+	uint8_t length;   // Payload length
+} RecordHeader;
+
+typedef struct __attribute__((packed)) {
+	uint32_t address_low;
+	uint16_t address_high;
+	int16_t temp;        // 1/100 °C
+	int16_t voltage;     // 10 mV
+	uint32_t timestamp;  // Host time of reception, RECORD_TICKS_PER_SECOND
+	uint8_t seq;
+	uint8_t flags;       // Same as OutputPacket flags, and RECORD_FLAG_*
+	uint8_t rssi;        // -dBm
+} RecordReading;
+
+#define RECORD_SIZE_MAX (sizeof(RecordHeader) + RECORD_PAYLOAD_MAX + 1)
+
+static inline uint8_t record_checksum(const uint8_t *data, uint32_t size) {
+	uint8_t sum = 0;
+	while (size--) {
+		sum += *data++;
+	}
+	return ~sum;
+}
+
+// Encodes a record into "buffer" of at least RECORD_SIZE_MAX bytes. Returns total record size.
+static inline uint32_t record_encode(uint8_t *buffer, RecordType type, const void *payload, uint8_t length) {
+	RecordHeader *header = (RecordHeader *)buffer;
+	header->sync = RECORD_SYNC;
+	header->type = type;
+	header->length = length;
+	memcpy(&buffer[sizeof(RecordHeader)], payload, length);
+	buffer[sizeof(RecordHeader) + length] = record_checksum(buffer, sizeof(RecordHeader) + length);
+	return sizeof(RecordHeader) + length + 1;
+}
+
+#endif
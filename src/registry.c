@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "registry.h"
+
+// Devices are kept in a dense array. An open addressing (linear probing) hash
+// table maps addresses to the array indexes. It is twice as big as the array,
+// so probe sequences stay short. Least recently used list is threaded through
+// the array indexes.
+
+_Static_assert((REGISTRY_CAPACITY & (REGISTRY_CAPACITY - 1)) == 0, "REGISTRY_CAPACITY must be a power of two");
+_Static_assert(REGISTRY_CAPACITY < 0x8000, "REGISTRY_CAPACITY too big");
+
+#define INDEX_SIZE (2 * REGISTRY_CAPACITY)
+#define INDEX_MASK (INDEX_SIZE - 1)
+#define NONE 0xFFFF
+
+typedef struct {
+	uint16_t prev;
+	uint16_t next;
+} LruLink;
+
+static Device devices[REGISTRY_CAPACITY];
+static LruLink lru_links[REGISTRY_CAPACITY];
+static uint16_t index_table[INDEX_SIZE]; // Device index + 1, 0 - empty slot
+static uint16_t device_count = 0;
+static uint16_t lru_head = NONE; // Most recently used
+static uint16_t lru_tail = NONE; // Least recently used
+static uint32_t eviction_count = 0;
+
+
+static uint32_t home_slot(uint32_t address_low, uint16_t address_high) {
+	uint32_t hash = (address_low ^ ((uint32_t)address_high << 16) ^ address_high) * 0x9E3779B1;
+	return (hash >> 16) & INDEX_MASK;
+}
+
+// Returns slot containing the device or an empty slot where it can be inserted.
+static uint32_t find_slot(uint32_t address_low, uint16_t address_high) {
+	uint32_t slot = home_slot(address_low, address_high);
+	while (index_table[slot] != 0) {
+		Device *device = &devices[index_table[slot] - 1];
+		if (device->address_low == address_low && device->address_high == address_high) {
+			break;
+		}
+		slot = (slot + 1) & INDEX_MASK;
+	}
+	return slot;
+}
+
+// Backward shift deletion, so no tombstones are needed.
+static void index_remove(uint16_t index) {
+	uint32_t hole = find_slot(devices[index].address_low, devices[index].address_high);
+	uint32_t slot = hole;
+	while (true) {
+		slot = (slot + 1) & INDEX_MASK;
+		if (index_table[slot] == 0) {
+			break;
+		}
+		Device *device = &devices[index_table[slot] - 1];
+		uint32_t home = home_slot(device->address_low, device->address_high);
+		// Move the entry to the hole if the hole is between its home slot and its current slot
+		if (((slot - home) & INDEX_MASK) >= ((slot - hole) & INDEX_MASK)) {
+			index_table[hole] = index_table[slot];
+			hole = slot;
+		}
+	}
+	index_table[hole] = 0;
+}
+
+static void lru_unlink(uint16_t index) {
+	LruLink *link = &lru_links[index];
+	if (link->prev != NONE) {
+		lru_links[link->prev].next = link->next;
+	} else {
+		lru_head = link->next;
+	}
+	if (link->next != NONE) {
+		lru_links[link->next].prev = link->prev;
+	} else {
+		lru_tail = link->prev;
+	}
+}
+
+static void lru_push_front(uint16_t index) {
+	lru_links[index].prev = NONE;
+	lru_links[index].next = lru_head;
+	if (lru_head != NONE) {
+		lru_links[lru_head].prev = index;
+	} else {
+		lru_tail = index;
+	}
+	lru_head = index;
+}
+
+Device *registry_find(uint32_t address_low, uint16_t address_high) {
+	uint16_t entry = index_table[find_slot(address_low, address_high)];
+	return entry ? &devices[entry - 1] : NULL;
+}
+
+Device *registry_get(uint32_t address_low, uint16_t address_high, uint32_t now) {
+	uint32_t slot = find_slot(address_low, address_high);
+	uint16_t index;
+	if (index_table[slot] != 0) {
+		index = index_table[slot] - 1;
+		lru_unlink(index);
+	} else {
+		if (device_count < REGISTRY_CAPACITY) {
+			index = device_count++;
+		} else {
+			index = lru_tail;
+			lru_unlink(index);
+			index_remove(index);
+			eviction_count++;
+			slot = find_slot(address_low, address_high);
+		}
+		memset(&devices[index], 0, sizeof(Device));
+		devices[index].address_low = address_low;
+		devices[index].address_high = address_high;
+		index_table[slot] = index + 1;
+	}
+	lru_push_front(index);
+	devices[index].last_seen = now;
+	return &devices[index];
+}
+
+uint32_t registry_count() {
+	return device_count;
+}
+
+Device *registry_device(uint32_t index) {
+	return &devices[index];
+}
+
+uint32_t registry_index(const Device *device) {
+	return device - devices;
+}
+
+uint32_t registry_evictions() {
+	return eviction_count;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "predictor.h"
+
+// Maximum number of dongles tracked by the host, must be a power of two.
+// RAM usage is 64 bytes per dongle.
+#ifndef REGISTRY_CAPACITY
+#define REGISTRY_CAPACITY 256
+#endif
+
+#define DEVICE_FLAG_SEQ_VALID 0x01
+
+// Per-dongle state kept by the host
+typedef struct {
+	uint32_t address_low;
+	uint16_t address_high;
+	uint8_t seq;            // Last sequence number seen
+	uint8_t flags;          // DEVICE_FLAG_*
+	int16_t temp;           // Last reading
+	int16_t voltage;
+	uint32_t last_seen;     // Host time of the last packet
+	uint16_t retries;       // Failed attempts reported by the dongle
+	uint16_t duplicates;    // Retransmissions after lost ACK
+	uint8_t link_quality;   // Smoothed first attempt success ratio, 255 = 100%
+	uint8_t downlink_id;    // Id of the last downlink applied by the dongle
+	uint16_t rssi_avg;      // Smoothed RSSI, -dBm in 1/16 units, 0 = no samples yet
+	uint32_t interval_ms;   // Report interval from the last packet of the dongle
+	Predictor predictor;    // Same as on the dongle, fills in skipped samples
+	bool predictor_synced;  // Dongle confirmed a predictor restart since it was added (predictor.h)
+} Device;
+
+// Returns the device or NULL if it is not known. O(1).
+Device *registry_find(uint32_t address_low, uint16_t address_high);
+
+// Returns the device, adds it if needed, and marks it as seen at "now". O(1).
+// When the registry is full, the least recently seen device is replaced.
+Device *registry_get(uint32_t address_low, uint16_t address_high, uint32_t now);
+
+// Number of known devices. They are available with registry_device(0 ... count - 1).
+uint32_t registry_count();
+
+Device *registry_device(uint32_t index);
+
+// Index of the device, stable for as long as the device is in the registry
+uint32_t registry_index(const Device *device);
+
+// Number of devices removed to make space for new ones
+uint32_t registry_evictions();
+
+#endif
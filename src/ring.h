@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Lock-free single-producer/single-consumer ring buffer indexes.
+//
+// Storage is an array owned by the user, its size must be a power of two.
+// Head is written only by the producer (e.g. ISR) and tail only by the consumer
+// (e.g. main loop). Both are free-running, so "head - tail" is the number of
+// items even after the counters wrap.
+typedef struct {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+} Ring;
+
+// Makes item contents visible before the index update (and the other way around).
+#define RING_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static inline uint32_t ring_count(const Ring *ring) {
+	return ring->head - ring->tail;
+}
+
+static inline bool ring_empty(const Ring *ring) {
+	return ring->head == ring->tail;
+}
+
+static inline bool ring_full(const Ring *ring, uint32_t size) {
+	return ring_count(ring) >= size;
+}
+
+// Index of the item that producer will write next.
+static inline uint32_t ring_head(const Ring *ring, uint32_t size) {
+	return ring->head & (size - 1);
+}
+
+// Index of the oldest item that consumer reads next.
+static inline uint32_t ring_tail(const Ring *ring, uint32_t size) {
+	return ring->tail & (size - 1);
+}
+
+// Producer: publish item at ring_head() after it was written.
+static inline void ring_push(Ring *ring) {
+	RING_BARRIER();
+	ring->head = ring->head + 1;
+}
+
+// Consumer: release item at ring_tail() after it was read.
+static inline void ring_pop(Ring *ring) {
+	RING_BARRIER();
+	ring->tail = ring->tail + 1;
+}
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nrf.h"
+#include "rtc_timer.h"
+#include "sched.h"
+
+// CC must be at least 2 ticks ahead of COUNTER, and at most half of its range
+static const uint32_t CC_MIN_AHEAD = 2;
+static const uint32_t CC_MAX_AHEAD = 0x7FFFFF;
+
+static volatile uint32_t overflow_count = 0;
+static RtcTimer *timers = NULL; // Running timers, earliest deadline first
+
+void rtc_timer_init() {
+	NRF_RTC0->PRESCALER = 3;
+	NRF_RTC0->EVTENSET = RTC_EVTENSET_COMPARE0_Msk | RTC_EVTENSET_OVRFLW_Msk;
+	NRF_RTC0->INTENSET = RTC_INTENSET_OVRFLW_Msk;
+	NRF_RTC0->TASKS_START = 1;
+}
+
+uint64_t rtc_now() {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t counter = NRF_RTC0->COUNTER;
+	uint32_t overflows = overflow_count;
+	if (NRF_RTC0->EVENTS_OVRFLW && counter < 0x800000) {
+		// Overflow interrupt is still pending
+		overflows++;
+	}
+	__set_PRIMASK(primask);
+	return ((uint64_t)overflows << 24) | counter;
+}
+
+// Interrupts must be disabled
+static void list_insert(RtcTimer *timer) {
+	RtcTimer **link = &timers;
+	while (*link && (*link)->deadline <= timer->deadline) {
+		link = &(*link)->next;
+	}
+	timer->next = *link;
+	*link = timer;
+	timer->running = true;
+}
+
+// Interrupts must be disabled
+static void list_remove(RtcTimer *timer) {
+	for (RtcTimer **link = &timers; *link; link = &(*link)->next) {
+		if (*link == timer) {
+			*link = timer->next;
+			break;
+		}
+	}
+	timer->running = false;
+}
+
+// Sets CC[0] to the earliest deadline. Interrupts must be disabled.
+static void program() {
+	if (timers == NULL) {
+		NRF_RTC0->INTENCLR = RTC_INTENCLR_COMPARE0_Msk;
+		return;
+	}
+	uint64_t now = rtc_now();
+	if (timers->deadline <= now) {
+		NVIC_SetPendingIRQ(RTC0_IRQn);
+		return;
+	}
+	uint64_t ahead = timers->deadline - now;
+	if (ahead < CC_MIN_AHEAD) {
+		ahead = CC_MIN_AHEAD;
+	} else if (ahead > CC_MAX_AHEAD) {
+		ahead = CC_MAX_AHEAD;
+	}
+	NRF_RTC0->EVENTS_COMPARE[0] = 0;
+	NRF_RTC0->CC[0] = (NRF_RTC0->COUNTER + (uint32_t)ahead) & RTC_COUNTER_COUNTER_Msk;
+	NRF_RTC0->INTENSET = RTC_INTENSET_COMPARE0_Msk;
+}
+
+void RTC0_IRQHandler() {
+	if (NRF_RTC0->EVENTS_OVRFLW) {
+		NRF_RTC0->EVENTS_OVRFLW = 0;
+		overflow_count++;
+	}
+	NRF_RTC0->EVENTS_COMPARE[0] = 0;
+	uint64_t now = rtc_now();
+	while (timers && timers->deadline <= now) {
+		RtcTimer *timer = timers;
+		timers = timer->next;
+		timer->running = false;
+		timer->expired = true;
+		sched_post(EVENT_TIMER);
+		if (timer->period) {
+			// Periods missed while interrupts were blocked are skipped
+			do {
+				timer->deadline += timer->period;
+			} while (timer->deadline <= now);
+			list_insert(timer);
+		}
+	}
+	program();
+}
+
+void rtc_timer_start(RtcTimer *timer, uint64_t deadline, uint32_t period) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (timer->running) {
+		list_remove(timer);
+	}
+	timer->deadline = deadline;
+	timer->period = period;
+	timer->expired = false;
+	list_insert(timer);
+	program();
+	__set_PRIMASK(primask);
+}
+
+void rtc_timer_stop(RtcTimer *timer) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (timer->running) {
+		list_remove(timer);
+		program();
+	}
+	__set_PRIMASK(primask);
+}
+
+bool rtc_compare_start(int channel, uint64_t deadline) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint64_t now = rtc_now();
+	bool started = deadline >= now + CC_MIN_AHEAD && deadline - now <= CC_MAX_AHEAD;
+	if (started) {
+		NRF_RTC0->EVENTS_COMPARE[channel] = 0;
+		NRF_RTC0->CC[channel] = deadline & RTC_COUNTER_COUNTER_Msk;
+		NRF_RTC0->EVTENSET = RTC_EVTENSET_COMPARE0_Msk << channel;
+	}
+	__set_PRIMASK(primask);
+	return started;
+}
+
+void rtc_compare_stop(int channel) {
+	NRF_RTC0->EVTENCLR = RTC_EVTENCLR_COMPARE0_Msk << channel;
+	NRF_RTC0->EVENTS_COMPARE[channel] = 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef RTC_TIMER_H
+#define RTC_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Timer service on RTC0. The RTC runs all the time, its 24-bit counter is
+// extended with OVRFLW events to a monotonic uptime that does not wrap.
+// Any number of timers can be running. They are kept sorted by deadline and
+// CC[0] is set to the earliest one, so timers expiring together cost one
+// wake-up. CC[1] and CC[2] are compares for events routed through PPI.
+
+#define RTC_TICKS_PER_SECOND 8192
+#define RTC_COMPARE_MAX_AHEAD 0x7FFFFF // Half of the counter range
+
+typedef struct RtcTimer {
+	struct RtcTimer *next;
+	uint64_t deadline;
+	uint32_t period;       // Restarts at deadline + period when expired, 0 - one-shot
+	bool running;
+	volatile bool expired; // Set from the RTC0 interrupt, that also posts EVENT_TIMER
+} RtcTimer;
+
+// Starts RTC0, LFCLK must be running. RTC0_IRQn must be enabled.
+void rtc_timer_init();
+
+// Uptime in RTC ticks.
+uint64_t rtc_now();
+
+// (Re)starts the timer. Deadline may be in the past, timer expires at once then.
+void rtc_timer_start(RtcTimer *timer, uint64_t deadline, uint32_t period);
+
+void rtc_timer_stop(RtcTimer *timer);
+
+static inline bool rtc_timer_expired(const RtcTimer *timer) {
+	return timer->expired;
+}
+
+// Generates NRF_RTC0->EVENTS_COMPARE[channel] (1 or 2) for PPI at the deadline, without
+// an interrupt. Returns false if the deadline is less than 2 ticks or more than
+// RTC_COMPARE_MAX_AHEAD ticks ahead, there will be no event then.
+bool rtc_compare_start(int channel, uint64_t deadline);
+
+// Must be called after the event, the compare would repeat when the counter wraps
+void rtc_compare_stop(int channel);
+
+#endif
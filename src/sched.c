@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "nrf.h"
+#include "sched.h"
+
+static volatile uint32_t pending = 0;
+static volatile bool posted = false;
+static Task *tasks = NULL;
+
+void sched_post(uint32_t events) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	pending |= events;
+	posted = true;
+	__set_PRIMASK(primask);
+}
+
+bool sched_take(uint32_t events) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	bool taken = (pending & events) != 0;
+	pending &= ~events;
+	__set_PRIMASK(primask);
+	return taken;
+}
+
+void sched_add(Task *task) {
+	task->line = 0;
+	task->next = tasks;
+	tasks = task;
+}
+
+void sched_run() {
+	while (1) {
+		posted = false;
+		Task **link = &tasks;
+		while (*link) {
+			Task *task = *link;
+			if (task->run(task)) {
+				link = &task->next;
+			} else {
+				*link = task->next;
+			}
+		}
+		// Anything posted while the tasks were running makes them run again
+		while (!posted) __WFE();
+	}
+}
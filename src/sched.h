@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Cooperative run-to-completion scheduler used by both the dongle and the host.
+//
+// Interrupt handlers only acknowledge the peripheral and post an event. Posted
+// events stay pending until a task takes them, so an event that comes before
+// the task starts waiting is not lost. The CPU sleeps only in sched_run(),
+// which runs all tasks again after anything was posted.
+//
+// Tasks are protothreads: the task function returns at each wait and continues
+// from there the next time it is run. Local variables are lost at waits, so
+// tasks keep their state in static variables. A wait must not be inside
+// a switch statement of the task function, and there can be only one wait per line.
+//
+// Both builds add one task. Its steps run as children with TASK_SPAWN, one after
+// another, so nothing overlaps yet: on the dongle, retries of a report delay the next
+// measurement (logged as "Period missed"). Running communicate_task() as its own task
+// needs the report to own the samples it sends, the crystal to be shared with the early
+// start, and the batch ring to stop dropping samples that are being sent.
+
+typedef enum {
+	EVENT_TIMER = 1 << 0,  // An RtcTimer expired
+	EVENT_HFCLK = 1 << 1,  // CLOCK HFCLKSTARTED
+	EVENT_LFCLK = 1 << 2,  // CLOCK LFCLKSTARTED
+	EVENT_TEMP = 1 << 3,   // TEMP DATARDY
+	EVENT_ADC = 1 << 4,    // ADC END
+	EVENT_RADIO = 1 << 5,  // RADIO DISABLED on the dongle
+	EVENT_RX = 1 << 6,     // Host received a packet into the RX queue
+	EVENT_BCMATCH = 1 << 7, // RADIO BCMATCH on the dongle
+} Event;
+
+typedef struct Task {
+	bool (*run)(struct Task *task); // Returns false when the task has ended
+	uint16_t line;                  // Where the task continues, 0 - from the beginning
+	struct Task *next;
+} Task;
+
+#define TASK_BEGIN(task) switch ((task)->line) { case 0:
+
+#define TASK_END(task) } (task)->line = 0; return false
+
+#define TASK_WAIT_UNTIL(task, condition) \
+	do { \
+		(task)->line = __LINE__; \
+		case __LINE__: \
+		if (!(condition)) { \
+			return true; \
+		} \
+	} while (0)
+
+// Waits for one of the events and takes it
+#define TASK_WAIT_EVENT(task, events) TASK_WAIT_UNTIL(task, sched_take(events))
+
+// Runs "function" as a child task, with "child" as its state, until it ends
+#define TASK_SPAWN(task, child, function) \
+	do { \
+		(child)->line = 0; \
+		TASK_WAIT_UNTIL(task, !function(child)); \
+	} while (0)
+
+// Can be called from interrupts
+void sched_post(uint32_t events);
+
+// Returns true if any of the events is pending, and takes them
+bool sched_take(uint32_t events);
+
+// Forgets stale events, before starting an operation that posts them
+static inline void sched_clear(uint32_t events) {
+	sched_take(events);
+}
+
+void sched_add(Task *task);
+
+// Runs the tasks, never returns
+void sched_run();
+
+#endif
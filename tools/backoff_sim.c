@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+// Collisions of many dongles retrying on one channel.
+//
+// All dongles power up at (almost) the same time, e.g. after a power cut, and
+// then report every interval. An exchange (report, turnaround, ACK) fails if
+// it overlaps another one. Two retry schedulers are compared:
+//   old - 1000 ms + 100 ms * 2 bits of the stale radio buffer + 200 ms per failure,
+//   new - random report phase, per period jitter and exponential backoff (backoff.h)
+//         from the RNG.
+// Old scheme schedules the next report one interval after the end of the previous one,
+// new one at fixed deadlines, as in the dongle main loop. TDMA slot correction is not modelled.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "backoff.h"
+#include "protocol.h"
+
+#define FAILED_COUNT_GIVE_UP 5
+
+typedef enum {
+	SCHEME_OLD,
+	SCHEME_NEW,
+} Scheme;
+
+typedef struct {
+	double exchange_us;    // Report, turnaround and ACK on air
+	double rx_timeout_us;  // Listening for ACK after a failed report
+	double interval_s;
+	double spread_us;      // Power up time differences
+	double duration_s;
+	uint32_t seed;
+} Config;
+
+typedef struct {
+	uint32_t rng;
+	uint8_t buffer[6];     // First bytes of the radio buffer, source of the old jitter
+	int rand_delay_index;
+	uint8_t seq;
+	int failed_count;
+	double report_start;   // First attempt of the current report
+	double deadline;       // Scheduled time of the current report, without jitter
+	double tx_end;
+	bool collided;
+	bool first_done;
+} Dongle;
+
+typedef struct {
+	double time;
+	int dongle;
+	bool end;
+} Event;
+
+typedef struct {
+	uint64_t delivered;
+	uint64_t attempts;
+	uint64_t given_up;
+	double latency_us;
+	double all_first_us;   // Time until every dongle delivered its first report
+} Result;
+
+static Event *heap;
+static int heap_size;
+
+static void heap_push(double time, int dongle, bool end) {
+	int i = heap_size++;
+	while (i > 0 && heap[(i - 1) / 2].time > time) {
+		heap[i] = heap[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap[i] = (Event){ time, dongle, end };
+}
+
+static Event heap_pop() {
+	Event top = heap[0];
+	Event last = heap[--heap_size];
+	int i = 0;
+	while (true) {
+		int child = 2 * i + 1;
+		if (child >= heap_size) {
+			break;
+		}
+		if (child + 1 < heap_size && heap[child + 1].time < heap[child].time) {
+			child++;
+		}
+		if (last.time <= heap[child].time) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = last;
+	return top;
+}
+
+// Xorshift, stands in for NRF_RNG. Low bits are as good as high bits, unlike in an LCG.
+static uint32_t random_next(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static double random_uniform(uint32_t *state) {
+	return ((random_next(state) >> 8) + 0.5) / (double)(1 << 24);
+}
+
+static double retry_delay_us(Scheme scheme, Dongle *d) {
+	if (scheme == SCHEME_NEW) {
+		return backoff_delay_ms(d->failed_count, random_next(&d->rng)) * 1000.0;
+	}
+	int bits = (d->buffer[d->rand_delay_index >> 3] >> (d->rand_delay_index & 7)) & 3;
+	d->rand_delay_index += 2;
+	if (d->rand_delay_index >= 48) {
+		d->rand_delay_index = 0;
+	}
+	return (1000 + 100 * bits + 200 * (d->failed_count - 1)) * 1000.0;
+}
+
+static double report_jitter_us(Scheme scheme, Dongle *d) {
+	if (scheme == SCHEME_OLD) {
+		return 0;
+	}
+	return (1 + (random_next(&d->rng) & (REPORT_JITTER_TICKS - 1))) * 1e6 / 8192;
+}
+
+static void start_report(const Config *cfg, Scheme scheme, Dongle *d, int index, double time) {
+	d->seq++;
+	d->failed_count = 0;
+	d->deadline = time;
+	time += report_jitter_us(scheme, d);
+	d->report_start = time;
+	// Radio buffer holds the length, seq and address of the last report
+	d->buffer[0] = OUTPUT_HEADER_LENGTH;
+	d->buffer[1] = d->seq;
+	heap_push(time, index, false);
+}
+
+static void simulate(const Config *cfg, Scheme scheme, int count, Result *res) {
+	Dongle *dongles = calloc(count, sizeof(Dongle));
+	int *active = calloc(count, sizeof(int));
+	int active_count = 0;
+	int first_pending = count;
+	double end = cfg->duration_s * 1e6;
+	uint32_t rng = cfg->seed ? cfg->seed : 1;
+
+	heap = calloc(2 * count + 1, sizeof(Event));
+	heap_size = 0;
+	memset(res, 0, sizeof(*res));
+
+	for (int i = 0; i < count; i++) {
+		Dongle *d = &dongles[i];
+		d->rng = random_next(&rng) | 1;
+		uint32_t address = random_next(&rng);
+		d->buffer[2] = address;
+		d->buffer[3] = address >> 8;
+		d->buffer[4] = address >> 16;
+		d->buffer[5] = random_next(&rng);
+		double start = random_uniform(&rng) * cfg->spread_us;
+		if (scheme == SCHEME_NEW) {
+			start += random_uniform(&d->rng) * cfg->interval_s * 1e6;
+		}
+		start_report(cfg, scheme, d, i, start);
+	}
+
+	while (heap_size > 0) {
+		Event ev = heap_pop();
+		Dongle *d = &dongles[ev.dongle];
+		if (ev.time > end) {
+			break;
+		}
+		if (!ev.end) {
+			// Overlapping exchanges destroy each other
+			d->collided = false;
+			for (int i = 0; i < active_count; i++) {
+				Dongle *other = &dongles[active[i]];
+				if (other->tx_end > ev.time) {
+					other->collided = true;
+					d->collided = true;
+				}
+			}
+			active[active_count++] = ev.dongle;
+			d->tx_end = ev.time + cfg->exchange_us;
+			res->attempts++;
+			heap_push(d->tx_end, ev.dongle, true);
+			continue;
+		}
+
+		for (int i = 0; i < active_count; i++) {
+			if (active[i] == ev.dongle) {
+				active[i] = active[--active_count];
+				break;
+			}
+		}
+		double next_report = ev.time;
+		if (!d->collided) {
+			res->delivered++;
+			res->latency_us += ev.time - d->report_start;
+			if (!d->first_done) {
+				d->first_done = true;
+				if (--first_pending == 0) {
+					res->all_first_us = ev.time;
+				}
+			}
+		} else {
+			d->failed_count++;
+			double failed_end = ev.time + cfg->rx_timeout_us;
+			if (d->failed_count < FAILED_COUNT_GIVE_UP) {
+				heap_push(failed_end + retry_delay_us(scheme, d), ev.dongle, false);
+				continue;
+			}
+			res->given_up++;
+			next_report = failed_end;
+		}
+		if (scheme == SCHEME_NEW) {
+			// Fixed cadence, missed periods are skipped
+			double deadline = d->deadline + cfg->interval_s * 1e6;
+			while (deadline < next_report) {
+				deadline += cfg->interval_s * 1e6;
+			}
+			next_report = deadline;
+		} else {
+			next_report += cfg->interval_s * 1e6;
+		}
+		start_report(cfg, scheme, d, ev.dongle, next_report);
+	}
+	if (first_pending > 0) {
+		res->all_first_us = -1;
+	}
+
+	free(heap);
+	free(active);
+	free(dongles);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "USAGE: %s [-i interval_s] [-p spread_us] [-d duration_s] [-s seed]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	static const int dongles[] = { 10, 20, 50, 100, 200, 500 };
+	Config cfg = {
+		// 250kbit: 32 us per byte, preamble, address, LENGTH, header, CRC. ACK after 40 us + 130 us ramp-up.
+		.exchange_us = (1 + 3 + 1 + OUTPUT_HEADER_LENGTH + 3) * 32 + 170 + (1 + 3 + 1 + INPUT_HEADER_LENGTH + 3) * 32,
+		.rx_timeout_us = 2000,
+		.interval_s = 5,
+		.spread_us = 1000,
+		.duration_s = 600,
+		.seed = 1,
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) usage(argv[0]);
+		if (strcmp(argv[i], "-i") == 0) cfg.interval_s = atof(argv[++i]);
+		else if (strcmp(argv[i], "-p") == 0) cfg.spread_us = atof(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0) cfg.duration_s = atof(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0) cfg.seed = atoi(argv[++i]);
+		else usage(argv[0]);
+	}
+
+	printf("Report interval %gs, power up spread %gus, exchange %gus, simulated %gs\n\n",
+		cfg.interval_s, cfg.spread_us, cfg.exchange_us, cfg.duration_s);
+	printf("%8s | %10s %9s %9s %10s | %10s %9s %9s %10s\n", "", "old", "", "", "", "new", "", "", "");
+	printf("%8s | %10s %9s %9s %10s | %10s %9s %9s %10s\n", "dongles",
+		"delivered", "attempts", "gave up", "all in s", "delivered", "attempts", "gave up", "all in s");
+	for (int i = 0; i < (int)(sizeof(dongles) / sizeof(dongles[0])); i++) {
+		Result res[2];
+		simulate(&cfg, SCHEME_OLD, dongles[i], &res[0]);
+		simulate(&cfg, SCHEME_NEW, dongles[i], &res[1]);
+		printf("%8d", dongles[i]);
+		for (int s = 0; s < 2; s++) {
+			char all[16];
+			if (res[s].all_first_us < 0) {
+				snprintf(all, sizeof(all), "never");
+			} else {
+				snprintf(all, sizeof(all), "%.2f", res[s].all_first_us / 1e6);
+			}
+			printf(" | %9.2f%% %9.2f %8.2f%% %10s",
+				100.0 * res[s].delivered / (res[s].delivered + res[s].given_up),
+				res[s].delivered ? (double)res[s].attempts / res[s].delivered : 0.0,
+				100.0 * res[s].given_up / (res[s].delivered + res[s].given_up), all);
+		}
+		printf("\n");
+	}
+	return 0;
+}
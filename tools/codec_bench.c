@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+// Compression ratio and encode cost of the batch codec (src/codec.c).
+//
+// Reads a CSV trace produced by rtt_decode, splits readings of each dongle
+// into batches and encodes them. Without a trace, a synthetic one is used.
+// Cycles are measured on the machine running the benchmark, not on the dongle.
+// Decoding of malformed input, as the host may receive it, is checked too.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "codec.h"
+
+#define MAX_DONGLES 1024
+#define LINE_MAX_LENGTH 256
+
+typedef struct {
+	uint64_t address;
+	BatchSample *samples;
+	size_t count;
+	size_t capacity;
+} Trace;
+
+static Trace traces[MAX_DONGLES];
+static int trace_count = 0;
+
+static uint64_t cycles_now() {
+#	if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#	else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#	endif
+}
+
+static void trace_add(uint64_t address, int16_t temp, int16_t voltage) {
+	Trace *trace = NULL;
+	for (int i = 0; i < trace_count; i++) {
+		if (traces[i].address == address) {
+			trace = &traces[i];
+			break;
+		}
+	}
+	if (trace == NULL) {
+		if (trace_count >= MAX_DONGLES) {
+			return;
+		}
+		trace = &traces[trace_count++];
+		trace->address = address;
+	}
+	if (trace->count == trace->capacity) {
+		trace->capacity = trace->capacity ? trace->capacity * 2 : 1024;
+		trace->samples = realloc(trace->samples, trace->capacity * sizeof(BatchSample));
+		if (!trace->samples) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	trace->samples[trace->count].temp = temp;
+	trace->samples[trace->count].voltage = voltage;
+	trace->count++;
+}
+
+// Fixed point value with two decimals, as written by rtt_decode
+static int16_t parse_fixed(const char *str) {
+	double value = atof(str);
+	return (int16_t)(value * 100 + (value < 0 ? -0.5 : 0.5));
+}
+
+static bool load_csv(const char *file_name) {
+	FILE *file = fopen(file_name, "r");
+	if (!file) {
+		perror(file_name);
+		return false;
+	}
+	char line[LINE_MAX_LENGTH];
+	while (fgets(line, sizeof(line), file)) {
+		// time,address,temp,voltage,...
+		char *fields[4];
+		char *p = line;
+		int n = 0;
+		while (n < 4) {
+			fields[n++] = p;
+			p = strchr(p, ',');
+			if (!p) {
+				break;
+			}
+			*p++ = 0;
+		}
+		if (n < 4 || fields[1][0] < '0' || fields[1][0] > 'F') {
+			continue; // Header or malformed line
+		}
+		trace_add(strtoull(fields[1], NULL, 16), parse_fixed(fields[2]), parse_fixed(fields[3]));
+	}
+	fclose(file);
+	return true;
+}
+
+// Random walk in NRF_TEMP steps and slowly discharging battery with ADC noise
+static void generate_synthetic(int dongles, int samples) {
+	uint32_t rng = 1;
+	for (int d = 0; d < dongles; d++) {
+		int temp = 2000 + d * 25;
+		int voltage = 300;
+		for (int i = 0; i < samples; i++) {
+			rng = rng * 1664525 + 1013904223;
+			int r = rng >> 24;
+			if (r < 16) {
+				temp += CODEC_TEMP_STEP;
+			} else if (r < 32) {
+				temp -= CODEC_TEMP_STEP;
+			}
+			if (r == 255 && voltage > 200) {
+				voltage--;
+			}
+			int noise = (r & 0x7F) == 3 ? 1 : 0;
+			trace_add(0x100000000000ULL + d, temp, voltage + noise);
+		}
+	}
+}
+
+// Nibble varints as in codec.h, without the checks of the encoder
+static int pack_varints(const uint32_t *values, int count, uint8_t *out) {
+	int nibbles = 0;
+	for (int i = 0; i < count; i++) {
+		uint32_t value = values[i];
+		do {
+			uint8_t nibble = (value & 7) | (value > 7 ? 8 : 0);
+			value >>= 3;
+			if (nibbles & 1) {
+				out[nibbles >> 1] |= nibble << 4;
+			} else {
+				out[nibbles >> 1] = nibble;
+			}
+			nibbles++;
+		} while (value);
+	}
+	return (nibbles + 1) >> 1;
+}
+
+// Returns number of malformed inputs that were not rejected
+static int check_malformed() {
+	static const struct {
+		const char *name;
+		int count;
+		uint32_t values[5];
+	} cases[] = {
+		{ "temp steps overflow", 4, { 2, 0, 0, 0xFFFFFFFE } },
+		{ "temp out of range", 4, { 2, 64000, 0, 400 } },
+		{ "voltage delta overflow", 5, { 2, 0, 0, 1, 0xFFFFFFFF } },
+		{ "first sample out of range", 3, { 1, 80000, 0 } },
+		{ "truncated", 4, { 3, 0, 0, 0 } },
+	};
+	int failed = 0;
+	for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+		uint8_t data[32];
+		int size = pack_varints(cases[i].values, cases[i].count, data);
+		BatchSample decoded[BATCH_MAX];
+		if (codec_decode(data, size, decoded, BATCH_MAX) >= 0) {
+			printf("Malformed input accepted: %s\n", cases[i].name);
+			failed++;
+		}
+	}
+	uint8_t endless[8];
+	memset(endless, 0xFF, sizeof(endless));
+	BatchSample decoded[BATCH_MAX];
+	if (codec_decode(endless, sizeof(endless), decoded, BATCH_MAX) >= 0) {
+		printf("Malformed input accepted: unterminated varint\n");
+		failed++;
+	}
+	return failed;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "USAGE: %s [-n batch_size] [-r repeats] [trace.csv]\n", name);
+	fprintf(stderr, "    -n  Samples per batch (default %d)\n", BATCH_MAX - 1);
+	fprintf(stderr, "    -r  Encode each batch this many times for timing (default 100)\n");
+	fprintf(stderr, "Uses a synthetic trace if trace file is not provided.\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *file_name = NULL;
+	int batch_size = BATCH_MAX - 1;
+	int repeats = 100;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			batch_size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			repeats = atoi(argv[++i]);
+		} else if (argv[i][0] == '-' || file_name) {
+			usage(argv[0]);
+		} else {
+			file_name = argv[i];
+		}
+	}
+	if (batch_size < 1 || repeats < 1) {
+		usage(argv[0]);
+	}
+
+	if (file_name) {
+		if (!load_csv(file_name)) {
+			return 1;
+		}
+	} else {
+		printf("Synthetic trace\n");
+		generate_synthetic(16, 10000);
+	}
+
+	uint64_t samples = 0;
+	uint64_t batches = 0;
+	uint64_t raw_bytes = 0;
+	uint64_t packed_bytes = 0;
+	uint64_t fallbacks = 0;
+	uint64_t errors = 0;
+	uint64_t cycles = 0;
+	for (int t = 0; t < trace_count; t++) {
+		const Trace *trace = &traces[t];
+		for (size_t first = 0; first < trace->count; first += batch_size) {
+			int count = trace->count - first < (size_t)batch_size ? trace->count - first : batch_size;
+			const BatchSample *batch = &trace->samples[first];
+			uint8_t out[BATCH_MAX * 2 * sizeof(BatchSample)];
+			int raw = count * sizeof(BatchSample);
+			int size = sizeof(out) < (size_t)raw ? sizeof(out) : raw;
+
+			uint64_t start = cycles_now();
+			int packed = 0;
+			for (int r = 0; r < repeats; r++) {
+				packed = codec_encode(batch, count, out, size);
+				__asm__ volatile("" : : "r"(out) : "memory");
+			}
+			cycles += cycles_now() - start;
+
+			if (packed < 0) {
+				// Dongle sends the samples unpacked then
+				fallbacks++;
+				packed = raw;
+			} else {
+				BatchSample decoded[BATCH_MAX * 2];
+				int n = codec_decode(out, packed, decoded, sizeof(decoded) / sizeof(decoded[0]));
+				if (n != count || memcmp(decoded, batch, count * sizeof(BatchSample)) != 0) {
+					errors++;
+				}
+			}
+			samples += count;
+			batches++;
+			raw_bytes += raw;
+			packed_bytes += packed;
+		}
+	}
+
+	if (samples == 0) {
+		fprintf(stderr, "No samples\n");
+		return 1;
+	}
+	printf("Dongles:            %d\n", trace_count);
+	printf("Samples:            %llu in %llu batches of up to %d\n",
+		(unsigned long long)samples, (unsigned long long)batches, batch_size);
+	printf("Raw bytes:          %llu (%.2f per sample)\n", (unsigned long long)raw_bytes, (double)raw_bytes / samples);
+	printf("Packed bytes:       %llu (%.2f per sample)\n", (unsigned long long)packed_bytes, (double)packed_bytes / samples);
+	printf("Compression ratio:  %.2f\n", (double)raw_bytes / packed_bytes);
+	printf("Sent unpacked:      %llu batches\n", (unsigned long long)fallbacks);
+#	if defined(__x86_64__) || defined(__i386__)
+	printf("Encode cost:        %.1f cycles per sample\n", (double)cycles / repeats / samples);
+#	else
+	printf("Encode cost:        %.1f ns per sample\n", (double)cycles / repeats / samples);
+#	endif
+	printf("Decode errors:      %llu\n", (unsigned long long)errors);
+	int malformed = check_malformed();
+	printf("Malformed accepted: %d\n", malformed);
+	return errors || malformed ? 1 : 0;
+}
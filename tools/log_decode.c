@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+// Formats deferred log captured from RTT channel 2 (LOG_DEFERRED=1 builds, see
+// src/log_record.h) with the format strings extracted from the firmware by the build.
+// String arguments are read from the flash image, if given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "log_record.h"
+
+#define INPUT_BLOCK_SIZE (64 * 1024)
+#define RECORD_SIZE_MAX (sizeof(LogHeader) + LOG_ARGS_MAX * sizeof(uint32_t))
+#define STRING_ARG_MAX 128
+
+static const char level_letters[] = "-EWIDT"; // LOG_LEVEL_* of src/log.h
+
+typedef struct {
+	const char *dictionary;
+	size_t dictionary_size;
+	const uint8_t *flash;
+	size_t flash_size;
+	uint64_t time;         // Unwrapped timestamp of the last record
+	bool line_start;
+	uint64_t records;
+	uint64_t skipped_bytes;
+} Decoder;
+
+static void *read_file(const char *file_name, size_t *size) {
+	FILE *file = fopen(file_name, "rb");
+	if (!file) {
+		perror(file_name);
+		exit(1);
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *data = malloc(length + 1);
+	if (!data || fread(data, 1, length, file) != (size_t)length) {
+		perror(file_name);
+		exit(1);
+	}
+	data[length] = 0;
+	fclose(file);
+	*size = length;
+	return data;
+}
+
+// Number of arguments taken by the format, -1 if it is not a valid one
+static int format_args(const char *format) {
+	int count = 0;
+	for (const char *p = format; *p; p++) {
+		if (*p != '%') {
+			continue;
+		}
+		p++;
+		p += strspn(p, "-0+ #");
+		p += strspn(p, "0123456789.");
+		p += strspn(p, "hl");
+		if (*p == 0 || !strchr("diuxXcsp%", *p)) {
+			return -1;
+		}
+		if (*p != '%') {
+			count++;
+		}
+	}
+	return count;
+}
+
+// Format must start at "offset", not be empty, and take the record's arguments
+static bool format_valid(const Decoder *dec, uint32_t offset, int args) {
+	if (offset >= dec->dictionary_size || dec->dictionary[offset] == 0 ||
+		(offset > 0 && dec->dictionary[offset - 1] != 0)) {
+		return false;
+	}
+	return format_args(&dec->dictionary[offset]) == args;
+}
+
+static void print_string(const Decoder *dec, const char *spec, uint32_t address) {
+	char str[STRING_ARG_MAX + 1];
+	if (address >= dec->flash_size) {
+		snprintf(str, sizeof(str), "<0x%08X>", address);
+	} else {
+		size_t n = dec->flash_size - address < STRING_ARG_MAX ? dec->flash_size - address : STRING_ARG_MAX;
+		memcpy(str, &dec->flash[address], n);
+		str[n] = 0;
+	}
+	printf(spec, str);
+}
+
+static void print_record(Decoder *dec, const LogHeader *header, const uint32_t *args) {
+	const char *format = &dec->dictionary[header->format];
+	char spec[16];
+	int arg = 0;
+	for (const char *p = format; *p; p++) {
+		if (dec->line_start) {
+			printf("%11.4f %c ", (double)dec->time / LOG_TICKS_PER_SECOND, level_letters[header->level_args >> 4]);
+			dec->line_start = false;
+		}
+		if (*p != '%') {
+			putchar(*p);
+			dec->line_start = *p == '\n';
+			continue;
+		}
+		// Host printf with the same flags and width, length modifiers dropped
+		const char *start = p++;
+		p += strspn(p, "-0+ #");
+		p += strspn(p, "0123456789.");
+		size_t length = p - start;
+		p += strspn(p, "hl");
+		if (*p == '%') {
+			putchar('%');
+			continue;
+		}
+		if (length > sizeof(spec) - 2) {
+			length = sizeof(spec) - 2;
+		}
+		memcpy(spec, start, length);
+		spec[length] = *p == 'p' ? 'x' : *p;
+		spec[length + 1] = 0;
+		uint32_t value = args[arg++];
+		switch (*p) {
+		case 'd':
+		case 'i':
+			printf(spec, (int32_t)value);
+			break;
+		case 's':
+			print_string(dec, spec, value);
+			break;
+		default:
+			printf(spec, value);
+			break;
+		}
+	}
+}
+
+// Decodes as many records as possible, returns number of bytes consumed.
+static size_t decode(Decoder *dec, const uint8_t *data, size_t size) {
+	size_t pos = 0;
+	while (pos + sizeof(LogHeader) <= size) {
+		LogHeader header;
+		memcpy(&header, &data[pos], sizeof(header));
+		int level = header.level_args >> 4;
+		int args = header.level_args & 15;
+		if (header.sync != LOG_SYNC || level == 0 || level >= (int)sizeof(level_letters) - 1 || args > LOG_ARGS_MAX ||
+			!format_valid(dec, header.format, args)) {
+			pos++;
+			dec->skipped_bytes++;
+			continue;
+		}
+		size_t total = sizeof(LogHeader) + args * sizeof(uint32_t);
+		if (pos + total > size) {
+			break;
+		}
+		uint32_t arg_values[LOG_ARGS_MAX];
+		memcpy(arg_values, &data[pos + sizeof(LogHeader)], args * sizeof(uint32_t));
+		// 32-bit timestamp wraps after 6 days
+		uint32_t last = (uint32_t)dec->time;
+		dec->time += (uint32_t)(header.timestamp - last);
+		print_record(dec, &header, arg_values);
+		dec->records++;
+		pos += total;
+	}
+	return pos;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "USAGE: %s [-f flash.bin] dictionary.logstr [input_file]\n", name);
+	fprintf(stderr, "    -f  Firmware binary image, for string arguments\n");
+	fprintf(stderr, "Reads stdin if input file is not provided.\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	static uint8_t input[INPUT_BLOCK_SIZE + RECORD_SIZE_MAX];
+	Decoder dec = { .line_start = true };
+	const char *dictionary_name = NULL;
+	const char *file_name = NULL;
+	FILE *file = stdin;
+	size_t pending = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+			dec.flash = read_file(argv[++i], &dec.flash_size);
+		} else if (argv[i][0] == '-' || file_name) {
+			usage(argv[0]);
+		} else if (dictionary_name) {
+			file_name = argv[i];
+		} else {
+			dictionary_name = argv[i];
+		}
+	}
+	if (!dictionary_name) {
+		usage(argv[0]);
+	}
+	dec.dictionary = read_file(dictionary_name, &dec.dictionary_size);
+
+	if (file_name) {
+		file = fopen(file_name, "rb");
+		if (!file) {
+			perror(file_name);
+			return 1;
+		}
+	}
+
+	while (true) {
+		size_t n = fread(&input[pending], 1, INPUT_BLOCK_SIZE, file);
+		if (n == 0) {
+			break;
+		}
+		pending += n;
+		size_t used = decode(&dec, input, pending);
+		// Keep incomplete record for the next block
+		if (pending - used > RECORD_SIZE_MAX) {
+			dec.skipped_bytes += pending - used - RECORD_SIZE_MAX;
+			used = pending - RECORD_SIZE_MAX;
+		}
+		memmove(input, &input[used], pending - used);
+		pending -= used;
+	}
+	dec.skipped_bytes += pending;
+	if (!dec.line_start) {
+		putchar('\n');
+	}
+
+	if (file != stdin) {
+		fclose(file);
+	}
+	fprintf(stderr, "%llu records, %llu bytes skipped\n",
+		(unsigned long long)dec.records, (unsigned long long)dec.skipped_bytes);
+	return 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+// Decodes binary record stream captured from the host RTT channel 1
+// (see src/records.h) into CSV or JSON lines.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "records.h"
+
+#define INPUT_BLOCK_SIZE (256 * 1024)
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+#define OUTPUT_LINE_MAX 256
+
+typedef struct {
+	bool json;
+	uint64_t records;
+	uint64_t skipped_bytes;
+	uint64_t unknown_records;
+	size_t out_size;
+} Decoder;
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+
+static void output_flush(Decoder *dec) {
+	fwrite(output_buffer, 1, dec->out_size, stdout);
+	dec->out_size = 0;
+}
+
+static char *put_str(char *p, const char *str) {
+	while (*str) {
+		*p++ = *str++;
+	}
+	return p;
+}
+
+static char *put_uint(char *p, uint32_t value) {
+	char tmp[10];
+	int n = 0;
+	do {
+		tmp[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	while (n) {
+		*p++ = tmp[--n];
+	}
+	return p;
+}
+
+static char *put_int(char *p, int32_t value) {
+	if (value < 0) {
+		*p++ = '-';
+		return put_uint(p, -(uint32_t)value);
+	}
+	return put_uint(p, value);
+}
+
+// Prints value / 10^decimals with fixed number of decimal places
+static char *put_fixed(char *p, int64_t value, int decimals) {
+	static const uint32_t pow10[] = { 1, 10, 100, 1000, 10000 };
+	uint64_t abs_value = value < 0 ? -value : value;
+	if (value < 0) {
+		*p++ = '-';
+	}
+	p = put_uint(p, abs_value / pow10[decimals]);
+	if (decimals > 0) {
+		uint32_t fraction = abs_value % pow10[decimals];
+		*p++ = '.';
+		for (int i = decimals - 1; i >= 0; i--) {
+			*p++ = '0' + (fraction / pow10[i]) % 10;
+		}
+	}
+	return p;
+}
+
+static char *put_address(char *p, uint16_t high, uint32_t low) {
+	static const char hex[] = "0123456789ABCDEF";
+	for (int i = 12; i >= 0; i -= 4) {
+		*p++ = hex[(high >> i) & 15];
+	}
+	for (int i = 28; i >= 0; i -= 4) {
+		*p++ = hex[(low >> i) & 15];
+	}
+	return p;
+}
+
+static void decode_reading(Decoder *dec, const uint8_t *payload, uint8_t length) {
+	RecordReading r;
+	memset(&r, 0, sizeof(r));
+	memcpy(&r, payload, length < sizeof(r) ? length : sizeof(r));
+	uint64_t time_ms = (uint64_t)r.timestamp * 1000 / RECORD_TICKS_PER_SECOND;
+	char *p = &output_buffer[dec->out_size];
+	if (dec->json) {
+		p = put_str(p, "{\"time\":");
+		p = put_fixed(p, time_ms, 3);
+		p = put_str(p, ",\"address\":\"");
+		p = put_address(p, r.address_high, r.address_low);
+		p = put_str(p, "\",\"temp\":");
+		p = put_fixed(p, r.temp, 2);
+		p = put_str(p, ",\"voltage\":");
+		p = put_fixed(p, r.voltage, 2);
+		p = put_str(p, ",\"seq\":");
+		p = put_uint(p, r.seq);
+		p = put_str(p, ",\"attempt\":");
+		p = put_uint(p, r.flags & 0x07);
+		if (r.rssi) {
+			p = put_str(p, ",\"rssi\":");
+			p = put_int(p, -r.rssi);
+		}
+		if (r.flags & RECORD_FLAG_ESTIMATED) {
+			p = put_str(p, ",\"estimated\":true");
+		}
+		p = put_str(p, "}\n");
+	} else {
+		p = put_fixed(p, time_ms, 3);
+		*p++ = ',';
+		p = put_address(p, r.address_high, r.address_low);
+		*p++ = ',';
+		p = put_fixed(p, r.temp, 2);
+		*p++ = ',';
+		p = put_fixed(p, r.voltage, 2);
+		*p++ = ',';
+		p = put_uint(p, r.seq);
+		*p++ = ',';
+		p = put_uint(p, r.flags & 0x07);
+		*p++ = ',';
+		if (r.rssi) {
+			p = put_int(p, -r.rssi);
+		}
+		*p++ = ',';
+		*p++ = (r.flags & RECORD_FLAG_ESTIMATED) ? '1' : '0';
+		*p++ = '\n';
+	}
+	dec->out_size = p - output_buffer;
+}
+
+// Decodes as many records as possible, returns number of bytes consumed.
+static size_t decode(Decoder *dec, const uint8_t *data, size_t size) {
+	size_t pos = 0;
+	while (pos + sizeof(RecordHeader) + 1 <= size) {
+		const RecordHeader *header = (const RecordHeader *)&data[pos];
+		if (header->sync != RECORD_SYNC || header->length > RECORD_PAYLOAD_MAX) {
+			pos++;
+			dec->skipped_bytes++;
+			continue;
+		}
+		size_t total = sizeof(RecordHeader) + header->length + 1;
+		if (pos + total > size) {
+			break;
+		}
+		if (record_checksum(&data[pos], total - 1) != data[pos + total - 1]) {
+			pos++;
+			dec->skipped_bytes++;
+			continue;
+		}
+		if (dec->out_size > OUTPUT_BUFFER_SIZE - OUTPUT_LINE_MAX) {
+			output_flush(dec);
+		}
+		const uint8_t *payload = &data[pos + sizeof(RecordHeader)];
+		switch (header->type) {
+		case RECORD_TYPE_READING:
+			decode_reading(dec, payload, header->length);
+			break;
+		default:
+			dec->unknown_records++;
+			break;
+		}
+		dec->records++;
+		pos += total;
+	}
+	return pos;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "USAGE: %s [-j] [input_file]\n", name);
+	fprintf(stderr, "    -j  Output JSON lines instead of CSV\n");
+	fprintf(stderr, "Reads stdin if input file is not provided.\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	static uint8_t input[INPUT_BLOCK_SIZE + RECORD_SIZE_MAX];
+	Decoder dec = { 0 };
+	const char *file_name = NULL;
+	FILE *file = stdin;
+	size_t pending = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0) {
+			dec.json = true;
+		} else if (argv[i][0] == '-' || file_name) {
+			usage(argv[0]);
+		} else {
+			file_name = argv[i];
+		}
+	}
+
+	if (file_name) {
+		file = fopen(file_name, "rb");
+		if (!file) {
+			perror(file_name);
+			return 1;
+		}
+	}
+
+	if (!dec.json) {
+		dec.out_size = put_str(output_buffer, "time,address,temp,voltage,seq,attempt,rssi,estimated\n") - output_buffer;
+	}
+
+	while (true) {
+		size_t n = fread(&input[pending], 1, INPUT_BLOCK_SIZE, file);
+		if (n == 0) {
+			break;
+		}
+		pending += n;
+		size_t used = decode(&dec, input, pending);
+		// Keep incomplete record for the next block
+		if (pending - used > RECORD_SIZE_MAX) {
+			dec.skipped_bytes += pending - used - RECORD_SIZE_MAX;
+			used = pending - RECORD_SIZE_MAX;
+		}
+		memmove(input, &input[used], pending - used);
+		pending -= used;
+	}
+	dec.skipped_bytes += pending;
+	output_flush(&dec);
+
+	if (file != stdin) {
+		fclose(file);
+	}
+	fprintf(stderr, "%llu records, %llu unknown, %llu bytes skipped\n",
+		(unsigned long long)dec.records, (unsigned long long)dec.unknown_records,
+		(unsigned long long)dec.skipped_bytes);
+	return 0;
+}
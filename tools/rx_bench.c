@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+// Host receive path throughput against a simulated radio.
+//
+// Dongles transmit at random (ALOHA) times. The host is modelled in two ways:
+//   before - output is formatted between END and ACK, radio is deaf meanwhile,
+//   after  - frame is pushed to the receive queue (ring.h) and ACKed at once,
+//            main loop formats the output from the queue in parallel.
+// Overlapping frames collide and are lost in both cases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "ring.h"
+
+#define RX_QUEUE_SIZE 16
+
+typedef struct {
+	double frame_us;       // Frame air time
+	double ack_us;         // ACK transmission including ramp-up
+	double turnaround_us;  // Delay before ACK ("wait for remote switch")
+	double rearm_us;       // RX ramp-up after ACK
+	double format_us;      // CPU time to format one packet to RTT
+	double duration_s;
+	uint32_t seed;
+} Config;
+
+typedef struct {
+	uint64_t offered;
+	uint64_t delivered;
+	uint64_t collided;
+	uint64_t deaf;
+	uint64_t queue_full;
+} Result;
+
+static uint32_t rng_state;
+
+static double random_uniform() {
+	rng_state = rng_state * 1664525 + 1013904223;
+	return ((rng_state >> 8) + 0.5) / (double)(1 << 24);
+}
+
+static double random_exp(double mean) {
+	double u = random_uniform();
+	return -mean * log(u);
+}
+
+static void simulate(const Config *cfg, int dongles, double interval_s, int queued, Result *res) {
+	Ring ring = { 0, 0 };
+	double queue_time[RX_QUEUE_SIZE];
+	double mean_gap = interval_s * 1e6 / dongles;
+	double end = cfg->duration_s * 1e6;
+	double t;
+	double prev_end = -1e9;
+	double deaf_until = 0;
+	double cpu_free = 0;
+
+	memset(res, 0, sizeof(*res));
+	rng_state = cfg->seed;
+	t = random_exp(mean_gap);
+
+	while (t < end) {
+		double next = t + random_exp(mean_gap);
+		double frame_end = t + cfg->frame_us;
+		bool collision = t < prev_end || next < frame_end;
+		prev_end = frame_end > prev_end ? frame_end : prev_end;
+		res->offered++;
+
+		// Consumer: finish formatting of packets that are done by now
+		while (queued && !ring_empty(&ring) && queue_time[ring_tail(&ring, RX_QUEUE_SIZE)] <= t) {
+			ring_pop(&ring);
+		}
+
+		if (collision) {
+			res->collided++;
+		} else if (t < deaf_until) {
+			res->deaf++;
+		} else if (!queued) {
+			deaf_until = frame_end + cfg->format_us + cfg->turnaround_us + cfg->ack_us + cfg->rearm_us;
+			res->delivered++;
+		} else if (ring_full(&ring, RX_QUEUE_SIZE)) {
+			res->queue_full++;
+		} else {
+			double start = frame_end > cpu_free ? frame_end : cpu_free;
+			cpu_free = start + cfg->format_us;
+			queue_time[ring_head(&ring, RX_QUEUE_SIZE)] = cpu_free;
+			ring_push(&ring);
+			deaf_until = frame_end + cfg->turnaround_us + cfg->ack_us + cfg->rearm_us;
+			res->delivered++;
+		}
+		t = next;
+	}
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "USAGE: %s [-f format_us] [-i interval_s] [-d duration_s] [-s seed]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	static const int dongles[] = { 10, 50, 100, 200, 500, 1000, 2000 };
+	double interval_s = 5;
+	Config cfg = {
+		// 250kbit: 1 byte preamble, 3 bytes address, 10 bytes payload, 3 bytes CRC
+		.frame_us = 17 * 32,
+		.ack_us = 140 + 17 * 32,
+		.turnaround_us = 122,
+		.rearm_us = 140,
+		// Eight SEGGER_RTT_printf calls with software division on 16 MHz Cortex-M0
+		.format_us = 8 * 200,
+		.duration_s = 3600,
+		.seed = 1,
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) usage(argv[0]);
+		if (strcmp(argv[i], "-f") == 0) cfg.format_us = atof(argv[++i]);
+		else if (strcmp(argv[i], "-i") == 0) interval_s = atof(argv[++i]);
+		else if (strcmp(argv[i], "-d") == 0) cfg.duration_s = atof(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0) cfg.seed = atoi(argv[++i]);
+		else usage(argv[0]);
+	}
+
+	printf("Report interval %gs, format %gus, simulated %gs\n\n", interval_s, cfg.format_us, cfg.duration_s);
+	printf("%8s %10s %14s %14s %12s %12s\n", "dongles", "offered/s", "before pkt/s", "after pkt/s", "lost before", "lost after");
+	for (int i = 0; i < (int)(sizeof(dongles) / sizeof(dongles[0])); i++) {
+		Result before;
+		Result after;
+		simulate(&cfg, dongles[i], interval_s, 0, &before);
+		simulate(&cfg, dongles[i], interval_s, 1, &after);
+		printf("%8d %10.1f %14.2f %14.2f %11.2f%% %11.2f%%\n", dongles[i],
+			before.offered / cfg.duration_s,
+			before.delivered / cfg.duration_s,
+			after.delivered / cfg.duration_s,
+			100.0 * before.deaf / before.offered,
+			100.0 * (after.deaf + after.queue_full) / after.offered);
+	}
+	return 0;
+}
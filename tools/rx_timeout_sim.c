@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2020 Nordic Semiconductor
+ *
+ * SPDX-License-Identifier: LicenseRef-BSD-5-Clause-Nordic
+ */
+
+// Time the dongle spends listening for ACKs, with jittery and lossy links.
+//
+// After each report the dongle listens until the ACK ends or its window expires.
+// Three windows are compared:
+//   old   - RTC window from the end of our packet to the end of the ACK, armed at any
+//           moment within a tick, ACK time measured in whole ticks. 1 + t + (t + 2) / 3 ticks
+//           after an ACK received after t ticks, at least 2, * 1.5 after each missed ACK.
+//   ticks - same RTC window, smoothed ACK time plus four mean deviations (ack_timeout.h),
+//           at least the earliest possible ACK, doubled from the second consecutive miss on.
+//   timer - TIMER0 window in us, as in the dongle: RX starts just before the earliest
+//           possible ACK, the ACK address must come within the window (ack_timeout.h),
+//           deviation term at least ACK_TIMEOUT_DEVIATION_MIN_US.
+// A late ACK (after the window) is lost like a dropped one, the report is retried after
+// the backoff delay (backoff.h), with the crystal running.
+//
+// Charge per report is the RX time, the TX of each attempt and the crystal during the
+// backoff delays, with approximate nRF51 currents at 0 dBm.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "ack_timeout.h"
+#include "protocol.h"
+#include "backoff.h"
+
+#define FAILED_COUNT_GIVE_UP 5
+
+static const double TICK_US = 1e6 / 8192;
+static const int RX_TIMEOUT_MAX_TICKS = 10 * 1024/125;
+static const int RX_TIMEOUT_MAX_US = 10000;
+// 40 us host turnaround, 140 us TX ramp-up, then preamble and address at 250kbit
+static const double ACK_ADDRESS_US = 40 + 140 + (1 + 3) * 32;
+// Rest of the shortest ACK: length, header and CRC
+static const double ACK_MIN_US = ACK_ADDRESS_US + (1 + INPUT_HEADER_LENGTH + 3) * 32;
+static const double RX_MARGIN_US = 16;
+// TX ramp-up and the shortest report
+static const double REPORT_US = 140 + (1 + 3 + 1 + OUTPUT_HEADER_LENGTH + 3) * 32;
+static const double RX_MA = 13;
+static const double TX_MA = 10.5;
+static const double HFXO_MA = 0.5;   // Crystal, CPU sleeping
+
+typedef enum {
+	SCHEME_OLD,
+	SCHEME_TICKS,
+	SCHEME_TIMER,
+	SCHEME_COUNT,
+} Scheme;
+
+static const char *scheme_names[] = { "old", "ticks", "timer" };
+
+typedef struct {
+	const char *name;
+	double jitter_us;      // Uniform
+	double exp_jitter_us;  // Exponential, mean
+	double spike_rate;     // Probability of a late ACK
+	double spike_us;       // Late ACKs come up to this much later
+	double drift_us;       // Slowly changing delay, amplitude
+	double loss;           // Probability of no ACK at all
+} Profile;
+
+typedef struct {
+	uint64_t reports;
+	uint64_t attempts;
+	uint64_t given_up;
+	uint64_t late;         // ACKs that came after the window
+	double rx_us;          // Total listening time
+	double idle_us;        // Listening in windows that expired
+	double backoff_us;     // Waiting for retries with the crystal running
+} Result;
+
+// Xorshift, as in backoff_sim
+static uint32_t random_next(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static double random_uniform(uint32_t *state) {
+	return ((random_next(state) >> 8) + 0.5) / (double)(1 << 24);
+}
+
+static int ack_floor_ticks() {
+	return (int)ceil(ACK_MIN_US / TICK_US) + 1;
+}
+
+static int ack_floor_us() {
+	return ACK_ADDRESS_US + RX_MARGIN_US;
+}
+
+// Delay of the ACK from the earliest possible, negative if there is none
+static double ack_delay_us(const Profile *p, uint64_t report, uint32_t *rng) {
+	if (random_uniform(rng) < p->loss) {
+		return -1;
+	}
+	double t = random_uniform(rng) * p->jitter_us;
+	if (p->exp_jitter_us > 0) {
+		t -= p->exp_jitter_us * log(random_uniform(rng));
+	}
+	if (p->drift_us > 0) {
+		t += p->drift_us * (1 - cos(report * 2 * M_PI / 1000)) / 2;
+	}
+	if (random_uniform(rng) < p->spike_rate) {
+		t += random_uniform(rng) * p->spike_us;
+	}
+	return t;
+}
+
+static void simulate(const Profile *p, Scheme scheme, uint64_t reports, uint32_t seed, Result *res) {
+	uint32_t rng = seed ? seed : 1;
+	int rx_timeout = scheme == SCHEME_TIMER ? RX_TIMEOUT_MAX_US : RX_TIMEOUT_MAX_TICKS;
+	AckTimeout estimator;
+	ack_timeout_reset(&estimator);
+	memset(res, 0, sizeof(*res));
+
+	for (uint64_t r = 0; r < reports; r++) {
+		res->reports++;
+		int attempt;
+		for (attempt = 0; attempt < FAILED_COUNT_GIVE_UP; attempt++) {
+			res->attempts++;
+			double delay_us = ack_delay_us(p, r, &rng);
+			double window_us, rx_start_us, ack_us;
+			double phase = 0;
+			if (scheme == SCHEME_TIMER) {
+				rx_timeout = ack_timeout_window(&estimator, ack_floor_us(), ACK_TIMEOUT_DEVIATION_MIN_US, RX_TIMEOUT_MAX_US);
+				window_us = rx_timeout;
+				rx_start_us = 40 - RX_MARGIN_US;
+				ack_us = ACK_ADDRESS_US + delay_us;
+			} else {
+				if (scheme == SCHEME_TICKS) {
+					rx_timeout = ack_timeout_window(&estimator, ack_floor_ticks(), 1, RX_TIMEOUT_MAX_TICKS);
+				}
+				// Window is armed at "phase" within the current tick
+				phase = random_uniform(&rng);
+				window_us = (rx_timeout - phase) * TICK_US;
+				rx_start_us = 0;
+				ack_us = ACK_MIN_US + delay_us;
+			}
+			if (delay_us < 0 || ack_us > window_us) {
+				if (delay_us >= 0) {
+					res->late++;
+				}
+				res->rx_us += window_us - rx_start_us;
+				res->idle_us += window_us - rx_start_us;
+				if (scheme == SCHEME_OLD) {
+					rx_timeout += rx_timeout / 2;
+					if (rx_timeout > RX_TIMEOUT_MAX_TICKS) {
+						rx_timeout = RX_TIMEOUT_MAX_TICKS;
+					}
+				} else {
+					ack_timeout_miss(&estimator);
+				}
+				if (attempt + 1 < FAILED_COUNT_GIVE_UP) {
+					res->backoff_us += backoff_delay_ms(attempt + 1, random_next(&rng)) * 1000.0;
+				}
+				continue;
+			}
+			res->rx_us += ACK_MIN_US + delay_us - rx_start_us;
+			if (scheme == SCHEME_TIMER) {
+				ack_timeout_sample(&estimator, (int)ack_us);
+			} else {
+				int receive_time = (int)(phase + ack_us / TICK_US);
+				if (scheme == SCHEME_TICKS) {
+					ack_timeout_sample(&estimator, receive_time);
+				} else {
+					rx_timeout = 1 + receive_time + (receive_time + 2) / 3;
+					if (rx_timeout < 2) {
+						rx_timeout = 2;
+					}
+				}
+			}
+			break;
+		}
+		if (attempt == FAILED_COUNT_GIVE_UP) {
+			res->given_up++;
+		}
+	}
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "USAGE: %s [-n reports] [-s seed]\n", name);
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	static const Profile profiles[] = {
+		{ .name = "steady", .jitter_us = 20, .loss = 0.01 },
+		{ .name = "jitter", .jitter_us = 50, .exp_jitter_us = 200, .loss = 0.02 },
+		{ .name = "spikes", .jitter_us = 50, .spike_rate = 0.05, .spike_us = 6000, .loss = 0.02 },
+		{ .name = "lossy", .jitter_us = 50, .loss = 0.25 },
+		{ .name = "drift", .jitter_us = 50, .drift_us = 3000, .loss = 0.02 },
+	};
+	uint64_t reports = 100000;
+	uint32_t seed = 1;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 >= argc) usage(argv[0]);
+		if (strcmp(argv[i], "-n") == 0) reports = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "-s") == 0) seed = atoi(argv[++i]);
+		else usage(argv[0]);
+	}
+
+	printf("%llu reports, earliest ACK address %.0fus, end %.0fus\n\n",
+		(unsigned long long)reports, ACK_ADDRESS_US, ACK_MIN_US);
+	printf("%8s", "");
+	for (int s = 0; s < SCHEME_COUNT; s++) {
+		printf(" | %-44s", scheme_names[s]);
+	}
+	printf("\n%8s", "profile");
+	for (int s = 0; s < SCHEME_COUNT; s++) {
+		printf(" | %6s %7s %8s %6s %6s %6s", "RX us", "idle us", "attempts", "late", "retry", "total");
+	}
+	printf("\n");
+	for (int i = 0; i < (int)(sizeof(profiles) / sizeof(profiles[0])); i++) {
+		printf("%8s", profiles[i].name);
+		for (int s = 0; s < SCHEME_COUNT; s++) {
+			Result res;
+			simulate(&profiles[i], s, reports, seed, &res);
+			// mA * us = nC
+			double retry_nc = (res.attempts - res.reports) * REPORT_US * TX_MA + res.backoff_us * HFXO_MA;
+			double total_nc = res.attempts * REPORT_US * TX_MA + res.rx_us * RX_MA + res.backoff_us * HFXO_MA;
+			printf(" | %6.0f %7.0f %8.3f %5.2f%% %6.2f %6.2f",
+				res.rx_us / res.reports,
+				res.idle_us / res.reports,
+				(double)res.attempts / res.reports,
+				100.0 * res.late / res.attempts,
+				retry_nc / res.reports / 1000,
+				total_nc / res.reports / 1000);
+		}
+		printf("\n");
+	}
+	printf("\nRX us - listening time per report, idle us - of it in windows without ACK,\n"
+		"late - ACKs after the window per attempt, retry - uC per report for the TX and\n"
+		"the backoff of retries, total - uC per report for RX, TX and backoff\n");
+	return 0;
+}